@@ -1,8 +1,14 @@
 #ifndef GFFPARSER_H
 #define GFFPARSER_H
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <variant>
 #include <vector>
@@ -14,6 +20,27 @@ enum class gff_field_type_t: int {
     SEQID = 0, SOURCE, TYPE, START, END, SCORE, STRAND, PHASE, ATTRIBUTES, FIELDSLEN
 };
 
+/**
+ * interned string (seqid, source, type, attribute name): small id in the global
+ * symbol table, compared as integer. Id 0 is the empty string. Ids are valid
+ * for the process lifetime and are not stable between runs.
+ */
+struct gff_symbol_t {
+    static constexpr uint32_t npos = 0xffffffff;
+    uint32_t id = 0;
+    gff_symbol_t() {}
+    explicit gff_symbol_t(std::string_view str); // interns str
+    static gff_symbol_t find(std::string_view str); // id npos if str is not interned
+    const std::string& str() const;
+    bool empty() const { return id == 0; }
+    bool operator==(const gff_symbol_t &s) const { return id == s.id; }
+    bool operator!=(const gff_symbol_t &s) const { return id != s.id; }
+};
+
+struct gff_symbol_hash_t {
+    std::size_t operator()(const gff_symbol_t &s) const { return s.id; }
+};
+
 struct gff_attr_t {
     bool is_string() const;
     bool is_integer() const;
@@ -51,6 +78,50 @@ struct gff_attribute_t
     gff_attribute_t& add_value(double val);
 };
 
+// record attributes: flat vector sorted by key symbol (one allocation per record)
+class gff_attr_list_t
+{
+public:
+    typedef std::pair<gff_symbol_t, gff_attr_t> value_type;
+    typedef std::vector<value_type>::const_iterator const_iterator;
+    const_iterator begin() const { return _items.begin(); }
+    const_iterator end() const { return _items.end(); }
+    const_iterator find(gff_symbol_t name) const;
+    gff_attr_t& operator[](gff_symbol_t name); // inserts an empty value if not found
+    std::size_t size() const { return _items.size(); }
+    bool empty() const { return _items.empty(); }
+    void reserve(std::size_t n) { _items.reserve(n); }
+    void shrink_to_fit() { _items.shrink_to_fit(); }
+private:
+    std::vector<value_type> _items;
+};
+
+/**
+ * @brief The gff_value_set_t class
+ * accepted values of an attribute (value and orvalues) compiled once: short lists are
+ * compared in order, string values of long lists are looked up in an open addressing table
+ */
+class gff_value_set_t
+{
+    static constexpr std::size_t hash_min = 8;
+    std::vector<gff_attr_t> _values;
+    std::vector<uint32_t> _slots; // index in _values + 1 of string values, 0 - empty slot
+    std::size_t _mask = 0;
+public:
+    gff_value_set_t() = default;
+    explicit gff_value_set_t(const gff_attribute_t &attr);
+    bool contains(const gff_attr_t &val) const;
+    bool contains_string(std::string_view val) const; // string typed value
+};
+
+// attribute projection: only the wanted attributes are stored on load
+struct gff_projection_t {
+    bool all = true;                 // no projection, every attribute is stored
+    bool keep_raw = false;           // keep the whole attributes column (gff_data_t::raw_attributes)
+    std::vector<gff_symbol_t> names; // wanted names, sorted by id
+    bool wants(gff_symbol_t name) const;
+};
+
 struct gff_postition_t {
     std::string seqid;
     uint64_t start;
@@ -70,27 +141,198 @@ struct gff_postition_t {
     bool intersect(const std::string &sid, uint64_t spos, uint64_t epos) const;
 };
 
+// record position (interned seqid)
+struct gff_location_t {
+    gff_symbol_t seqid;
+    uint64_t start = 0;
+    uint64_t end = 0;
+    bool empty() const;
+    bool in(uint64_t pos) const;
+    bool intersect(uint64_t spos, uint64_t epos) const;
+};
+
 struct gff_data_t {
     static double d_nodata;
-    std::string source;
-    std::string type;
-    gff_postition_t position;
+    gff_symbol_t source;
+    gff_symbol_t type;
+    gff_location_t position;
     double score = d_nodata;
     char strand = 0;
     char phase = 0;
     uint64_t linenum;
-    std::unordered_map<std::string, gff_attr_t> attributes;
+    gff_attr_list_t attributes;
+    std::string raw_attributes; // attributes column as is (only if the projection keeps it)
     bool has_attr(const std::string &name) const;
     bool eq_attr(const std::string &name, const gff_attr_t &val) const;
+    bool eq_attr(gff_symbol_t name, const gff_attr_t &val) const;
     const gff_attr_t& get_attr(const std::string &name) const;
+    const gff_attr_t& get_attr(gff_symbol_t name) const;
     void set_attr_auto(const std::string &name, const std::string &val);
     void set_attr(const std::string &name, const std::string &val);
     void set_attr(const std::string &name, int64_t val);
     void set_attr(const std::string &name, double val);
+    void set_attr_auto(gff_symbol_t name, std::string_view val);
+    void set_attr(gff_symbol_t name, const std::string &val);
+    void set_attr(gff_symbol_t name, int64_t val);
+    void set_attr(gff_symbol_t name, double val);
+    gff_attr_list_t parse_raw_attrs(bool onlystrval = false) const; // full attribute list from raw_attributes
     std::string str() const;
     bool empty() const;
 };
 
+// load time record filter (predicate pushdown): lines not matching are not stored
+struct gff_load_filter_t {
+    bool any_type = true;
+    gff_symbol_t type;
+    bool any_source = true;
+    gff_symbol_t source;
+    std::vector<gff_symbol_t> names;     // every attribute must be present
+    std::vector<gff_value_set_t> values; // and have one of the values
+    void set(const std::string &type, const std::string &source, const std::vector<gff_attribute_t> &attr);
+    bool empty() const { return any_type && any_source && names.empty(); }
+    bool match(const gff_data_t &data) const;
+};
+
+// query filter compiled once: type and attribute name symbols, value sets (no per record lookups by name)
+struct gff_filter_t {
+    bool any_type = true;
+    gff_symbol_t type;
+    std::vector<gff_symbol_t> names;     // every attribute must be present
+    std::vector<gff_value_set_t> values; // and have one of the values
+    gff_filter_t() = default;
+    gff_filter_t(const std::string &type, const std::vector<gff_attribute_t> &attr);
+    bool empty() const { return any_type && names.empty(); }
+    bool match(const gff_data_t &data) const;
+};
+
+// text range of a seqid block of a gff file (a new block starts at every data line with another seqid)
+struct gff_seqid_block_t {
+    std::string seqid;
+    uint64_t begin = 0;   // file offset of the first line
+    uint64_t end = 0;     // file offset after the last line
+    uint64_t linenum = 0; // line number of the first line
+};
+
+// text of a seqid block for lazy loading
+struct gff_text_block_t {
+    uint64_t linenum = 1; // line number of the first line
+    std::string text;
+};
+
+// position query of a batch (the seqid text must live during the call)
+struct gff_query_t {
+    std::string_view seqid;
+    uint64_t start = 0;
+    uint64_t end = 0;
+};
+
+/**
+ * @brief The gff_columns_t struct
+ * structure of arrays copy of the scanned record fields (index - record id in the parser data):
+ * scans read compact columns instead of whole records
+ */
+struct gff_columns_t {
+    std::vector<uint32_t> seqid;       // symbol ids
+    std::vector<uint32_t> type;
+    std::vector<uint32_t> source;
+    std::vector<uint32_t> attr_offset; // names of record i: attr_name[attr_offset[i], attr_offset[i+1])
+    std::vector<uint32_t> attr_name;   // attribute name ids (sorted inside a record)
+    void build(const std::vector<gff_data_t> &data);
+    void clear();
+    std::size_t size() const { return seqid.size(); }
+    bool has_attr(std::size_t id, gff_symbol_t name) const;
+    bool has_attrs(std::size_t id, const std::vector<gff_symbol_t> &names) const;
+};
+
+class gff_interval_index_t
+{
+    // implicit augmented interval tree (record ids sorted by start,
+    // _maxend holds the max end position of every implicit subtree,
+    // _start/_end - positions of the items, the traversal doesn't touch the records)
+    gff_data_t *_base = nullptr; // records the ids refer to
+    std::vector<uint32_t> _ids;
+    std::vector<uint64_t> _start;
+    std::vector<uint64_t> _end;
+    std::vector<uint64_t> _maxend;
+    void fill_positions();
+    int _maxlevel = -1;
+public:
+    void build(gff_data_t *base, std::vector<uint32_t> &&ids);
+    // stored tree (snapshot), false if maxend/maxlevel don't fit the ids count
+    bool assign(gff_data_t *base, std::vector<uint32_t> &&ids, std::vector<uint64_t> &&maxend, int maxlevel);
+    void overlap(uint64_t spos, uint64_t epos, std::vector<gff_data_t*> &out) const;
+    // f(i) for every item i overlapping [spos, epos], tree order (not sorted), no allocation
+    template<typename F>
+    void for_each_overlap(uint64_t spos, uint64_t epos, F &&f) const;
+    std::size_t upper_bound(uint64_t pos) const; // first item with start > pos
+    gff_data_t* item(std::size_t i) const { return _base + _ids[i]; }
+    uint64_t start(std::size_t i) const { return _start[i]; }
+    uint64_t end(std::size_t i) const { return _end[i]; }
+    const std::vector<uint32_t>& ids() const;
+    const std::vector<uint64_t>& maxend() const;
+    int maxlevel() const;
+    std::size_t size() const;
+    bool empty() const;
+};
+
+template<typename F>
+void gff_interval_index_t::for_each_overlap(uint64_t spos, uint64_t epos, F &&f) const
+{
+    if(_maxlevel < 0 || spos > epos) return;
+    struct node_t {
+        int64_t x;
+        int k;
+        bool left_done;
+    };
+    const int64_t n = static_cast<int64_t>(_ids.size());
+    node_t stack[64];
+    int t = 0;
+    stack[t++] = {(int64_t(1) << _maxlevel) - 1, _maxlevel, false};
+    while(t) {
+        node_t z = stack[--t];
+        if(z.k <= 3) { // small subtree, linear scan
+            int64_t i0 = z.x >> z.k << z.k;
+            int64_t i1 = std::min(n, i0 + (int64_t(1) << (z.k + 1)) - 1);
+            for(int64_t i = i0; i < i1 && _start[i] <= epos; ++i)
+                if(_end[i] >= spos)
+                    f(static_cast<std::size_t>(i));
+        }
+        else if(!z.left_done) {
+            int64_t y = z.x - (int64_t(1) << (z.k - 1)); // left child, may be out of range
+            stack[t++] = {z.x, z.k, true};
+            if(y >= n || _maxend[y] >= spos)
+                stack[t++] = {y, z.k - 1, false};
+        }
+        else if(z.x < n && _start[z.x] <= epos) {
+            if(_end[z.x] >= spos)
+                f(static_cast<std::size_t>(z.x));
+            stack[t++] = {z.x + (int64_t(1) << (z.k - 1)), z.k - 1, false};
+        }
+    }
+}
+
+/**
+ * @brief The gff_id_index_t class
+ * record ids grouped by a symbol (type, source) in one contiguous array, ascending inside a group
+ */
+class gff_id_index_t
+{
+public:
+    typedef std::pair<uint32_t, uint32_t> range_t; // [begin, end) in ids()
+private:
+    std::unordered_map<gff_symbol_t, range_t, gff_symbol_hash_t> _groups;
+    std::vector<uint32_t> _ids;
+public:
+    // keys[id] - symbol id of record id, one counting pass + one placing pass
+    void build(const std::vector<uint32_t> &keys);
+    void add(gff_symbol_t key, const std::vector<uint32_t> &ids); // snapshot load
+    range_t find(gff_symbol_t key) const; // empty range if there is no key
+    const std::unordered_map<gff_symbol_t, range_t, gff_symbol_hash_t>& groups() const { return _groups; }
+    const std::vector<uint32_t>& ids() const { return _ids; }
+    std::size_t size() const { return _groups.size(); }
+    void clear();
+};
+
 struct gff_data_tmp_t {
     std::vector<gff_data_t> data;
     uint64_t linestart = 0;
@@ -103,28 +345,57 @@ class thread_pool_t
         std::string data;
         uint64_t lnum;
     };
+    struct thr_chunk_t {
+        std::vector<thr_data_t> lines;
+        std::string_view text; // newline aligned block of a mapped file
+        uint64_t lnum = 0;     // number of the first line in text
+    };
+
+    static constexpr std::size_t min_lines_in_chunk = 256;
+    static constexpr std::size_t max_lines_in_chunk = 16384;
+    static constexpr std::size_t queue_per_thread = 4;
 
     std::mutex _data_mtx;
     std::mutex _tmpdata_mtx;
+    std::mutex _queue_mtx;
+    std::condition_variable _queue_cv; // new chunk or stop
+    std::condition_variable _space_cv; // free slot in the queue
+    std::condition_variable _idle_cv;  // queue drained, no busy workers
     int _thrmax;
-    std::string *_error;
+    std::string _error;               // first error of the workers (under _data_mtx)
+    std::atomic<bool> _failed{false};
     bool _attronlystr;
-    std::vector<thr_data_t> _tmpdata;
+    const gff_projection_t *_projection;
+    const gff_load_filter_t *_filter;
+    bool _stop = false;
+    std::size_t _busy = 0;
+    std::size_t _chunk_size = min_lines_in_chunk;
+    thr_chunk_t _tmpdata;
+    std::deque<thr_chunk_t> _queue;
     std::vector<gff_data_tmp_t> _data;
-    std::deque<std::thread> _tpool;
+    std::vector<std::thread> _tpool;
     static void thrproc(
-        std::vector<thr_data_t> &&data, std::mutex *mtx,
-        std::vector<gff_data_tmp_t> *out, std::string *error,
-        bool attrval_onlystr
+        thr_chunk_t &&data, std::mutex *mtx,
+        std::vector<gff_data_tmp_t> *out, std::string *error, std::atomic<bool> *failed,
+        bool attrval_onlystr, const gff_projection_t *projection,
+        const gff_load_filter_t *filter
         );
+    void worker();
+    void wait_idle();
 public:
-    thread_pool_t(int threads, std::string *error, bool attronlystr)
-        : _thrmax(threads), _error(error), _attronlystr(attronlystr) {}
+    thread_pool_t(int threads, bool attronlystr,
+                  const gff_projection_t *projection, const gff_load_filter_t *filter)
+        : _thrmax(threads), _attronlystr(attronlystr), _projection(projection), _filter(filter) {}
+    ~thread_pool_t();
     void push(const std::string &line, uint64_t linenum);
+    void push_block(std::string_view text, uint64_t linenum);
+    std::size_t chunk_size() const;
     void flush();
     bool empty();
     std::vector<gff_data_tmp_t> data();
-    void makeproc(std::vector<thr_data_t> &&data, bool sync = false);
+    bool has_error() const { return _failed.load(std::memory_order_acquire); }
+    std::string error();
+    void makeproc(thr_chunk_t &&data, bool sync = false);
 };
 
 class gff_parser_t
@@ -134,35 +405,87 @@ class gff_parser_t
     int _gff_version;
     uint64_t _linenum;
     bool _onlystrval;
+    bool _indexed = false; // flush() done, queries are read only
+    gff_projection_t _projection;
+    gff_load_filter_t _filter;
     std::string _error;
     std::vector<gff_data_t> _data;
-    std::unordered_map<std::string, std::vector<gff_data_t*> > _data_by_seqid;
-    std::unordered_map<std::string, std::vector<gff_data_t*> > _data_by_source;
-    std::unordered_map<std::string, std::vector<gff_data_t*> > _data_by_type;
+    std::unordered_map<gff_symbol_t, gff_interval_index_t, gff_symbol_hash_t> _data_by_seqid;
+    gff_id_index_t _data_by_source;
+    gff_id_index_t _data_by_type;
+    gff_columns_t _columns; // of _data
+    // inverted attribute index (on demand): name -> value key -> record ids (ascending)
+    std::unordered_map<gff_symbol_t, std::unordered_map<std::string, std::vector<uint32_t> >, gff_symbol_hash_t> _data_by_attr;
+    void build_indexes();
+    void build_attr_index(gff_symbol_t name);
+public:
+    // text of the seqid block(s) for lazy loading, false - read error
+    typedef std::function<bool(const std::string &seqid, std::vector<gff_text_block_t> &blocks, std::string &error)> seqid_loader_t;
+private:
+    struct lazy_seqid_t {
+        std::once_flag once;
+        std::vector<gff_data_t> data;
+        std::string error;
+    };
+    seqid_loader_t _seqid_loader;
+    std::unordered_map<gff_symbol_t, std::unique_ptr<lazy_seqid_t>, gff_symbol_hash_t> _lazy;
+    const gff_interval_index_t* find_seqid(gff_symbol_t seqid);
+    void load_seqid(gff_symbol_t seqid, lazy_seqid_t &lazy);
+    void lazy_matches(const gff_filter_t &filter, std::vector<gff_data_t*> &r);
+    bool attr_candidates(const std::vector<gff_attribute_t> &attr, std::vector<uint32_t> &ids) const;
 
     enum class force_type_t{ ft_int, ft_flt, ft_str };
     std::unordered_map<std::string, force_type_t> _force_types;
 
 public:
-    static gff_data_t parse_line(const std::string &line, std::string &error, uint64_t linenum, bool onlystrinval);
+    static gff_data_t parse_line(std::string_view line, std::string &error, uint64_t linenum, bool onlystrinval,
+                                 const gff_projection_t *projection = nullptr,
+                                 const gff_load_filter_t *filter = nullptr);
     explicit gff_parser_t(int threads = 0, bool attrval_only_string = false)
         : _threads(threads)
         , _gff_version(0), _linenum(0), _onlystrval(attrval_only_string) {
-        if(threads > 0) _thrpool.reset(new thread_pool_t(threads, &_error, attrval_only_string));
+        if(threads > 0) _thrpool.reset(new thread_pool_t(threads, attrval_only_string, &_projection, &_filter));
     }
     std::string dump(const std::string &prefix) const;
     gff_parser_t& operator<<(const std::string &line);
+    // blocks (optional) - the seqid blocks met on the way (see set_seqid_loader())
+    void load_file(const std::string &path, std::vector<gff_seqid_block_t> *blocks = nullptr);
+    void save_snapshot(const std::string &path);
+    void load_snapshot(const std::string &path);
+    static bool is_snapshot(const std::string &path);
     bool has_error() const;
     std::string error() const;
     bool empty() const;
     uint64_t linenum() const;
     void flush();
     std::size_t size() const;
+    const gff_columns_t& columns() const { return _columns; } // loaded records (not lazy seqids), after flush()
+    const std::vector<gff_data_t>& data() const { return _data; } // the same records, index - record id
 
     void setattr_force_str(const std::string &field);
     void setattr_force_int(const std::string &field);
     void setattr_force_flt(const std::string &field);
+    void index_attr(const std::string &name);
+    // store only these attributes (call before loading); keep_raw keeps the whole column too (text input)
+    void set_attr_projection(const std::vector<std::string> &names, bool keep_raw = false);
+    // store only the records matching the filter (call before loading)
+    void set_load_filter(const std::string &type, const std::string &source, const std::vector<gff_attribute_t> &attr);
+    // records of these seqids are parsed on the first position query of the seqid (after flush());
+    // get_by(type, attr) without a position parses all of them, get_by_type/get_by_attr and size() don't see them
+    void set_seqid_loader(const std::vector<std::string> &seqids, seqid_loader_t loader);
 
+    const gff_interval_index_t* index_by_seqid(std::string_view seqid);
+    // records overlapping [start, end] and matching the filter, file order; out is cleared and
+    // refilled, a caller reusing it doesn't allocate once it has grown
+    void overlap(std::string_view seqid, uint64_t start, uint64_t end, const gff_filter_t &filter, std::vector<gff_data_t*> &out);
+    // visitor(gff_data_t&) for every record of overlap(), straight from the interval index:
+    // index order (start ascending), not the file order of overlap(); no allocation
+    template<typename F>
+    void for_each_overlap(std::string_view seqid, uint64_t start, uint64_t end, const gff_filter_t &filter, F &&visitor);
+    // records of queries[i] (as overlap()), called once per query: grouped by seqid, start ascending
+    typedef std::function<void(std::size_t i, const std::vector<gff_data_t*> &items)> batch_sink_t;
+    // queries are sorted and answered by one sweep of every seqid index
+    void get_by_batch(const std::vector<gff_query_t> &queries, const gff_filter_t &filter, const batch_sink_t &sink);
     std::vector<gff_data_t*> get_by_pos(const gff_postition_t &position);
     std::vector<gff_data_t*> get_by_type(const std::string &type);
     std::vector<gff_data_t*> get_by_attr(const std::vector<gff_attribute_t> &attr);
@@ -186,12 +509,64 @@ public:
 
 };
 
+template<typename F>
+void gff_parser_t::for_each_overlap(std::string_view seqid, uint64_t start, uint64_t end, const gff_filter_t &filter, F &&visitor)
+{
+    auto index = index_by_seqid(seqid);
+    if(!index) return;
+    index->for_each_overlap(start, end, [&](std::size_t i) {
+        auto *d = index->item(i);
+        if(filter.match(*d)) visitor(*d);
+    });
+}
+
+/**
+ * sweep-line cursor for coordinate sorted queries (same seqid grouped, start ascending):
+ * keeps features overlapping the current position, each query only advances the cursor.
+ * A new seqid, a smaller start or a far jump re-seeds the cursor from the interval index.
+ * One cursor per thread, gff_parser_t must be flushed and not modified while in use.
+ */
+class gff_sweep_t
+{
+    static constexpr std::size_t reseed_gap = 64;    // items to pass before the query start, more - re-seed
+    static constexpr std::size_t prefetch_ahead = 8; // records are prefetched while activated
+    gff_parser_t *_gff;
+    const gff_interval_index_t *_index = nullptr;
+    std::string _seqid;
+    std::size_t _next = 0;            // first item not yet activated
+    uint64_t _lastpos = 0;            // start of the last query
+    std::vector<uint32_t> _active;    // activated items (positions in the index) with end >= _lastpos
+    bool _seeded = false;
+    void seed(uint64_t start, uint64_t end);
+public:
+    explicit gff_sweep_t(gff_parser_t &gff): _gff(&gff) {}
+    // as gff_parser_t::overlap (out is reused)
+    void overlap(std::string_view seqid, uint64_t start, uint64_t end, const gff_filter_t &filter, std::vector<gff_data_t*> &out);
+    std::vector<gff_data_t*> get_by_pos(const gff_postition_t &position);
+    std::vector<gff_data_t*> get_by(
+        const std::string &type,
+        const std::vector<gff_attribute_t> &attr,
+        const gff_postition_t &position
+        );
+};
+
 namespace utils {
-bool check_no_data(const std::string &str);
+enum class delims_impl_t { best, scalar, sse2, avx2 };
+// offsets of all bytes of str equal to one of delims (up to 4 chars) in one pass;
+// SIMD kernel is picked at runtime (impl forces one, falls back to the best available)
+void find_delims(std::string_view str, std::string_view delims, std::vector<uint32_t> &offsets, delims_impl_t impl = delims_impl_t::best);
+bool check_no_data(std::string_view str);
+// std::from_chars based number parsing (no exceptions, no temporary strings):
+// like strtol/strtod skips leading spaces, accepts '+' and stops at the first non-number char,
+// false if there is no number or it is out of range
+bool parse_int(std::string_view str, int64_t &val);
+bool parse_double(std::string_view str, double &val);
 std::string join_strmap(const std::unordered_map<std::string, std::string> &strmap);
 std::vector<std::string> get_fields(const std::string &line, char delim, bool csv_string_format);
 std::vector< std::pair<std::string, std::string> > get_subfields(const std::string &line, char delim, char subdelim, std::string &error, bool csv_string_format);
+std::vector< std::pair<std::string_view, std::string_view> > get_subfields_view(std::string_view line, char delim, char subdelim, std::string &error, bool csv_string_format);
 std::string trim(const std::string &str);
+std::string_view trim_view(std::string_view str);
 }
 }
 
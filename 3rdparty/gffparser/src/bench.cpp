@@ -0,0 +1,159 @@
+#include <gffparser.h>
+#include <iostream>
+#include <chrono>
+#include <functional>
+
+using namespace gffparser;
+
+// tokenizer microbenchmark: bytes/sec of the delimiter kernels and of
+// get_fields/get_subfields_view against the previous find()-based versions
+
+// previous implementation (std::string::find / find_first_of + substr)
+static std::vector<std::string> old_get_fields(const std::string &line, char delim, bool csv_string_format)
+{
+    std::vector<std::string> r;
+    std::size_t delim_cnt = 0;
+    auto it = line.find(delim);
+    size_t prev = 0;
+    while(it != std::string::npos) {
+        delim_cnt++;
+        std::string part = line.substr(prev, it-prev);
+        if(csv_string_format && part.length() > 0 && part.at(0) == '"') {
+            auto it2 = line.find('"', prev + 1);
+            if(it2 != std::string::npos && it2 > it) {
+                prev += 1; // "...
+                it = it2;
+                part = line.substr(prev, it-prev);
+                it += 1; // ..."
+            }
+            else if(part.front() == '"' && part.back() == '"') {
+                part = part.substr(1, part.length()-2);
+            }
+        }
+        r.push_back(std::move(part));
+        prev = it + 1;
+        it = line.find(delim, prev);
+    }
+    if(prev != line.length())
+        r.push_back(line.substr(prev));
+    else if(delim_cnt == r.size())
+        r.push_back("");
+    return r;
+}
+
+static std::vector< std::pair<std::string_view, std::string_view> > old_get_subfields_view(std::string_view line, char delim, char subdelim, std::string &error, bool csv_string_format)
+{
+    std::vector< std::pair<std::string_view, std::string_view> > r;
+    const char delims[] = {delim, subdelim};
+    const std::string_view multidelim(delims, 2);
+    auto it = line.find_first_of(multidelim);
+    size_t prev = 0;
+    while(it != std::string_view::npos) {
+        std::string_view part = line.substr(prev, it-prev);
+        if(!part.empty()) {
+            if(line[it] == delim) { // сразу разделитель, нет значения, напр 'par1<delim>par2<delim>...'
+                r.push_back({part, ""});
+            }
+            else { // разделитель параметр/значение, 'par1<subdelim>val1<delim>par2<delim>...'
+                if(it == (line.length()-1)) { // конец строки (par1<subdelim>\n)
+                    r.push_back({part, ""});
+                }
+                else if(line[it+1] == delim) { // конец параметра без значения (par1<subdelim><delim>\n)
+                    r.push_back({part, ""});
+                    it += 1;
+                }
+                else if(csv_string_format && line[it+1] == '"') { // начало параметра строки (par1<subdelim>")
+                    auto nextquote = line.find('"', it+2);
+                    if(nextquote == std::string_view::npos) { // ошибка парсинга
+                        error = "string format in parameter error (pos=" + std::to_string(it+1) + ")";
+                        return r;
+                    }
+                    std::string_view subpart = line.substr(it+2, nextquote-it-2);
+                    r.push_back({part, subpart});
+                    it = nextquote;
+                    if(it != (line.length()-1)) {
+                        if(line[it+1] == delim)
+                            ++it;
+                        else {
+                            error = "string format in parameter error (pos=" + std::to_string(it+1) + ")";
+                            return r;
+                        }
+                    }
+                }
+                else {
+                    auto nextdelim = line.find(delim, it+1);
+                    if(nextdelim == std::string_view::npos) {
+                        r.push_back({part, line.substr(it+1)});
+                    }
+                    else {
+                        r.push_back({part, line.substr(it+1, nextdelim - it - 1)});
+                        it = nextdelim;
+                    }
+                }
+            }
+        }
+        prev = it + 1;
+        it = line.find_first_of(multidelim, prev);
+    }
+    return r;
+}
+
+static volatile std::size_t sink_total = 0; // keeps results alive
+
+static void run(const std::string &name, std::size_t bytes_per_iter, const std::function<std::size_t()> &fn)
+{
+    using std::chrono::steady_clock;
+    std::size_t sink = 0;
+    std::size_t iters = 0;
+    auto start = steady_clock::now();
+    double sec = 0;
+    do {
+        for(int i = 0; i < 64; ++i) sink += fn();
+        iters += 64;
+        sec = std::chrono::duration<double>(steady_clock::now() - start).count();
+    } while(sec < 0.5);
+    std::cout << name << ": "
+              << static_cast<double>(bytes_per_iter) * iters / sec / (1024 * 1024) << " MB/s" << std::endl;
+    sink_total = sink_total + sink;
+}
+
+int main() {
+    // GENCODE-like attributes column and BED line
+    std::string attrs;
+    for(int i = 0; i < 4; ++i) {
+        attrs += "ID=ENST00000456328.2;Parent=ENSG00000290825.1;gene_id=ENSG00000290825.1;"
+                 "transcript_id=ENST00000456328.2;gene_type=lncRNA;gene_name=DDX11L2;"
+                 "transcript_type=lncRNA;transcript_name=DDX11L2-202;level=2;"
+                 "transcript_support_level=1;tag=basic,Ensembl_canonical;havana_transcript=OTTHUMT00000362751.1;";
+    }
+    attrs += "note=\"quoted;value=with delimiters\"";
+    std::string bed = "chr1\t11868\t14409\tENST00000456328.2\t0\t+\t11868\t14409\t0,0,0\t3\t359,109,1189,\t0,744,1352,";
+
+    std::vector<uint32_t> offsets;
+    std::string error;
+    const std::pair<const char*, utils::delims_impl_t> impls[] = {
+        {"scalar", utils::delims_impl_t::scalar},
+        {"sse2", utils::delims_impl_t::sse2},
+        {"avx2", utils::delims_impl_t::avx2},
+        {"best", utils::delims_impl_t::best}
+    };
+    for(const auto &impl: impls) {
+        run(std::string("find_delims ") + impl.first, attrs.size(), [&]() {
+            utils::find_delims(attrs, ";=\"", offsets, impl.second);
+            return offsets.size();
+        });
+    }
+    run("get_subfields_view old", attrs.size(), [&]() {
+        return old_get_subfields_view(attrs, ';', '=', error, true).size();
+    });
+    run("get_subfields_view new", attrs.size(), [&]() {
+        return utils::get_subfields_view(attrs, ';', '=', error, true).size();
+    });
+    run("get_fields old", bed.size(), [&]() {
+        return old_get_fields(bed, '\t', false).size();
+    });
+    run("get_fields new", bed.size(), [&]() {
+        return utils::get_fields(bed, '\t', false).size();
+    });
+    return 0;
+}
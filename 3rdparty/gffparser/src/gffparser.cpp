@@ -1,16 +1,124 @@
 #include <gffparser.h>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <iterator>
 #include <regex>
+#include <shared_mutex>
 #include <sstream>
+#include <stdexcept>
 #include <limits>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define GFF_X86_DISPATCH
+#endif
 using namespace gffparser;
 
 double gff_data_t::d_nodata = std::numeric_limits<double>::max();
 
-bool gffparser::utils::check_no_data(const std::string &str)
+// global symbol table: strings are stored in fixed blocks (never moved),
+// so str() reads without locking, interning takes the write lock only for new strings
+class symbol_table_t
+{
+    static constexpr uint32_t block_bits = 16;
+    static constexpr uint32_t block_size = 1u << block_bits;
+    static constexpr uint32_t max_blocks = 1u << 16;
+    std::unique_ptr<std::string[]> _blocks[max_blocks];
+    std::unordered_map<std::string_view, uint32_t> _ids;
+    uint32_t _count = 0;
+    std::shared_mutex _mtx;
+    uint32_t add(std::string_view str) {
+        uint32_t id = _count;
+        auto &block = _blocks[id >> block_bits];
+        if(!block) block.reset(new std::string[block_size]);
+        auto &val = block[id & (block_size - 1)];
+        val = str;
+        _ids.emplace(val, id);
+        ++_count;
+        return id;
+    }
+public:
+    symbol_table_t() {
+        add(""); // id 0
+    }
+    uint32_t find(std::string_view str) {
+        std::shared_lock<std::shared_mutex> lk(_mtx);
+        auto it = _ids.find(str);
+        return it == _ids.end() ? gff_symbol_t::npos : it->second;
+    }
+    uint32_t intern(std::string_view str) {
+        auto id = find(str);
+        if(id != gff_symbol_t::npos) return id;
+        std::unique_lock<std::shared_mutex> lk(_mtx);
+        auto it = _ids.find(str);
+        if(it != _ids.end()) return it->second;
+        if(_count == gff_symbol_t::npos) throw std::length_error("gff symbol table overflow");
+        return add(str);
+    }
+    const std::string& str(uint32_t id) const {
+        static const std::string empty;
+        if(id == gff_symbol_t::npos) return empty;
+        return _blocks[id >> block_bits][id & (block_size - 1)];
+    }
+};
+
+static symbol_table_t& symbols()
+{
+    static symbol_table_t table;
+    return table;
+}
+
+gff_symbol_t::gff_symbol_t(std::string_view str)
+    : id(str.empty() ? 0 : symbols().intern(str))
+{
+}
+
+gff_symbol_t gff_symbol_t::find(std::string_view str)
+{
+    gff_symbol_t r;
+    if(!str.empty()) r.id = symbols().find(str);
+    return r;
+}
+
+const std::string &gff_symbol_t::str() const
+{
+    return symbols().str(id);
+}
+
+bool gffparser::utils::check_no_data(std::string_view str)
 {
     return str.empty() || str == "." || str == "na" || str == "NA" || str == "N/A" || str == "n/a";
 }
 
+// strtol/strtod compatible prefix: leading spaces and '+' are skipped
+static std::string_view number_prefix(std::string_view str)
+{
+    std::size_t i = 0;
+    while(i < str.size() && std::isspace(static_cast<unsigned char>(str[i]))) ++i;
+    if(i + 1 < str.size() && str[i] == '+' && str[i+1] != '-') ++i;
+    return str.substr(i);
+}
+
+bool gffparser::utils::parse_int(std::string_view str, int64_t &val)
+{
+    str = number_prefix(str);
+    auto res = std::from_chars(str.data(), str.data() + str.size(), val);
+    return res.ec == std::errc();
+}
+
+bool gffparser::utils::parse_double(std::string_view str, double &val)
+{
+    str = number_prefix(str);
+    auto res = std::from_chars(str.data(), str.data() + str.size(), val);
+    return res.ec == std::errc();
+}
+
 std::string gffparser::utils::join_strmap(const std::unordered_map<std::string, std::string> &strmap)
 {
     if(strmap.empty()) return "";
@@ -22,17 +130,136 @@ std::string gffparser::utils::join_strmap(const std::unordered_map<std::string,
     return r;
 }
 
+// delimiter scanning kernels: offsets of every byte equal to one of d[0..3]
+typedef void (*delims_kernel_t)(const char *str, std::size_t len, const char *d, std::vector<uint32_t> &offsets);
+
+static void find_delims_scalar(const char *str, std::size_t len, const char *d, std::vector<uint32_t> &offsets)
+{
+    for(std::size_t i = 0; i < len; ++i) {
+        char c = str[i];
+        if(c == d[0] || c == d[1] || c == d[2] || c == d[3])
+            offsets.push_back(static_cast<uint32_t>(i));
+    }
+}
+
+#ifdef GFF_X86_DISPATCH
+#ifdef __SSE2__
+static void find_delims_sse2(const char *str, std::size_t len, const char *d, std::vector<uint32_t> &offsets)
+{
+    const __m128i d0 = _mm_set1_epi8(d[0]), d1 = _mm_set1_epi8(d[1]);
+    const __m128i d2 = _mm_set1_epi8(d[2]), d3 = _mm_set1_epi8(d[3]);
+    std::size_t i = 0;
+    for(; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, d0), _mm_cmpeq_epi8(v, d1)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, d2), _mm_cmpeq_epi8(v, d3)));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(m));
+        while(mask) {
+            offsets.push_back(static_cast<uint32_t>(i + __builtin_ctz(mask)));
+            mask &= mask - 1;
+        }
+    }
+    std::size_t tail = offsets.size();
+    find_delims_scalar(str + i, len - i, d, offsets);
+    for(; tail < offsets.size(); ++tail) offsets[tail] += static_cast<uint32_t>(i);
+}
+#endif
+
+__attribute__((target("avx2")))
+static void find_delims_avx2(const char *str, std::size_t len, const char *d, std::vector<uint32_t> &offsets)
+{
+    const __m256i d0 = _mm256_set1_epi8(d[0]), d1 = _mm256_set1_epi8(d[1]);
+    const __m256i d2 = _mm256_set1_epi8(d[2]), d3 = _mm256_set1_epi8(d[3]);
+    std::size_t i = 0;
+    for(; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + i));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, d0), _mm256_cmpeq_epi8(v, d1)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(v, d2), _mm256_cmpeq_epi8(v, d3)));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(m));
+        while(mask) {
+            offsets.push_back(static_cast<uint32_t>(i + __builtin_ctz(mask)));
+            mask &= mask - 1;
+        }
+    }
+    std::size_t tail = offsets.size();
+    find_delims_scalar(str + i, len - i, d, offsets);
+    for(; tail < offsets.size(); ++tail) offsets[tail] += static_cast<uint32_t>(i);
+}
+#endif
+
+static delims_kernel_t select_delims_kernel()
+{
+#ifdef GFF_X86_DISPATCH
+    if(__builtin_cpu_supports("avx2")) return find_delims_avx2;
+#ifdef __SSE2__
+    return find_delims_sse2;
+#endif
+#endif
+    return find_delims_scalar;
+}
+
+static delims_kernel_t delims_kernel(utils::delims_impl_t impl)
+{
+    static const delims_kernel_t best = select_delims_kernel();
+    switch(impl) {
+    case utils::delims_impl_t::scalar: return find_delims_scalar;
+#if defined(GFF_X86_DISPATCH) && defined(__SSE2__)
+    case utils::delims_impl_t::sse2: return find_delims_sse2;
+#endif
+#ifdef GFF_X86_DISPATCH
+    case utils::delims_impl_t::avx2: return __builtin_cpu_supports("avx2") ? find_delims_avx2 : best;
+#endif
+    default: return best;
+    }
+}
+
+void gffparser::utils::find_delims(std::string_view str, std::string_view delims, std::vector<uint32_t> &offsets, delims_impl_t impl)
+{
+    offsets.clear();
+    if(delims.empty() || str.empty()) return;
+    // unused slots repeat the first delimiter
+    char d[4] = {delims[0], delims[0], delims[0], delims[0]};
+    for(std::size_t i = 1; i < delims.size() && i < 4; ++i) d[i] = delims[i];
+    delims_kernel(impl)(str.data(), str.size(), d, offsets);
+}
+
+// forward-only search over the find_delims() offsets (search positions never go back)
+class delims_cursor_t
+{
+    std::string_view _str;
+    const std::vector<uint32_t> &_offsets;
+    std::size_t _i = 0;
+public:
+    delims_cursor_t(std::string_view str, const std::vector<uint32_t> &offsets)
+        : _str(str), _offsets(offsets) {}
+    std::size_t find(std::size_t from, char c1, char c2) {
+        while(_i < _offsets.size() && _offsets[_i] < from) ++_i;
+        for(auto j = _i; j < _offsets.size(); ++j) {
+            char c = _str[_offsets[j]];
+            if(c == c1 || c == c2) return _offsets[j];
+        }
+        return std::string_view::npos;
+    }
+    std::size_t find(std::size_t from, char c) {
+        return find(from, c, c);
+    }
+};
+
 std::vector<std::string> gffparser::utils::get_fields(const std::string &line, char delim, bool csv_string_format)
 {
     std::vector<std::string> r;
-    int delim_cnt = 0;
-    auto it = line.find(delim);
+    thread_local std::vector<uint32_t> offsets;
+    const char delims[] = {delim, '"'};
+    find_delims(line, std::string_view(delims, csv_string_format ? 2 : 1), offsets);
+    delims_cursor_t cursor(line, offsets);
+    std::size_t delim_cnt = 0;
+    auto it = cursor.find(0, delim);
     size_t prev = 0;
     while(it != std::string::npos) {
         delim_cnt++;
         std::string part = line.substr(prev, it-prev);
         if(csv_string_format && part.length() > 0 && part.at(0) == '"') {
-            auto it2 = line.find('"', prev + 1);
+            auto it2 = cursor.find(prev + 1, '"');
             if(it2 != std::string::npos && it2 > it) {
                 prev += 1; // "...
                 it = it2;
@@ -45,7 +272,7 @@ std::vector<std::string> gffparser::utils::get_fields(const std::string &line, c
         }
         r.push_back(std::move(part));
         prev = it + 1;
-        it = line.find(delim, prev);
+        it = cursor.find(prev, delim);
     }
     if(prev != line.length())
         r.push_back(line.substr(prev));
@@ -54,14 +281,17 @@ std::vector<std::string> gffparser::utils::get_fields(const std::string &line, c
     return r;
 }
 
-std::vector< std::pair<std::string, std::string> > utils::get_subfields(const std::string &line, char delim, char subdelim, std::string &error, bool csv_string_format)
+std::vector< std::pair<std::string_view, std::string_view> > utils::get_subfields_view(std::string_view line, char delim, char subdelim, std::string &error, bool csv_string_format)
 {
-    std::vector< std::pair<std::string, std::string> > r;
-    const std::string multidelim = {delim, subdelim};
-    auto it = line.find_first_of(multidelim);
+    std::vector< std::pair<std::string_view, std::string_view> > r;
+    thread_local std::vector<uint32_t> offsets;
+    const char delims[] = {delim, subdelim, '"'};
+    find_delims(line, std::string_view(delims, csv_string_format ? 3 : 2), offsets);
+    delims_cursor_t cursor(line, offsets);
+    auto it = cursor.find(0, delim, subdelim);
     size_t prev = 0;
-    while(it != std::string::npos) {
-        std::string part = line.substr(prev, it-prev);
+    while(it != std::string_view::npos) {
+        std::string_view part = line.substr(prev, it-prev);
         if(!part.empty()) {
             if(line[it] == delim) { // сразу разделитель, нет значения, напр 'par1<delim>par2<delim>...'
                 r.push_back({part, ""});
@@ -75,12 +305,12 @@ std::vector< std::pair<std::string, std::string> > utils::get_subfields(const st
                     it += 1;
                 }
                 else if(csv_string_format && line[it+1] == '"') { // начало параметра строки (par1<subdelim>")
-                    auto nextquote = line.find('"', it+2);
-                    if(nextquote == std::string::npos) { // ошибка парсинга
+                    auto nextquote = cursor.find(it+2, '"');
+                    if(nextquote == std::string_view::npos) { // ошибка парсинга
                         error = "string format in parameter error (pos=" + std::to_string(it+1) + ")";
                         return r;
                     }
-                    std::string subpart = line.substr(it+2, nextquote-it-2);
+                    std::string_view subpart = line.substr(it+2, nextquote-it-2);
                     r.push_back({part, subpart});
                     it = nextquote;
                     if(it != (line.length()-1)) {
@@ -93,8 +323,8 @@ std::vector< std::pair<std::string, std::string> > utils::get_subfields(const st
                     }
                 }
                 else {
-                    auto nextdelim = line.find(delim, it+1);
-                    if(nextdelim == std::string::npos) {
+                    auto nextdelim = cursor.find(it+1, delim);
+                    if(nextdelim == std::string_view::npos) {
                         r.push_back({part, line.substr(it+1)});
                     }
                     else {
@@ -105,18 +335,30 @@ std::vector< std::pair<std::string, std::string> > utils::get_subfields(const st
             }
         }
         prev = it + 1;
-        it = line.find_first_of(multidelim, prev);
+        it = cursor.find(prev, delim, subdelim);
     }
     return r;
 }
 
-std::string gffparser::utils::trim(const std::string &str)
+std::vector< std::pair<std::string, std::string> > utils::get_subfields(const std::string &line, char delim, char subdelim, std::string &error, bool csv_string_format)
+{
+    std::vector< std::pair<std::string, std::string> > r;
+    for(const auto &sf: get_subfields_view(line, delim, subdelim, error, csv_string_format))
+        r.push_back({std::string(sf.first), std::string(sf.second)});
+    return r;
+}
+
+std::string_view gffparser::utils::trim_view(std::string_view str)
 {
     auto s = std::find_if_not(str.begin(), str.end(), [](int c){return std::isspace(c);});
-    if(s == str.end()) s = str.begin();
+    if(s == str.end()) return str;
     auto e = std::find_if_not(str.rbegin(), str.rend(), [](int c){return std::isspace(c);});
-    if(e == str.rend()) e = str.rbegin();
-    return std::string(s, e.base());
+    return str.substr(s - str.begin(), e.base() - s);
+}
+
+std::string gffparser::utils::trim(const std::string &str)
+{
+    return std::string(trim_view(str));
 }
 
 bool gff_attr_t::is_string() const
@@ -194,46 +436,157 @@ bool gff_attr_t::eq(const gff_attr_t &v) const
     return _value == v._value;
 }
 
-bool convert_str_to_uint64(const std::string &ival, uint64_t &oval)
+static bool convert_str_to_uint64(std::string_view ival, uint64_t &oval)
 {
-    try {
-        oval = std::stoll(ival);
-        return true;
+    int64_t v;
+    if(!utils::parse_int(ival, v)) return false;
+    oval = static_cast<uint64_t>(v);
+    return true;
+}
+
+static bool convert_str_to_double(std::string_view ival, double &oval)
+{
+    return utils::parse_double(ival, oval);
+}
+
+// attribute value typing: digits - integer, digits with one dot - float, else string
+static gff_attr_t auto_typed_value(std::string_view val)
+{
+    bool isdigit = true;
+    int dotcnt = 0;
+    for(const auto &c: val) {
+        if(c == '.') {
+            ++dotcnt;
+        }
+        else if(!std::isdigit(static_cast<unsigned char>(c))) {
+            isdigit = false;
+            break;
+        }
     }
-    catch(...) {}
-    return false;
+    if(isdigit && dotcnt == 1) {
+        double d;
+        if(utils::parse_double(val, d)) return gff_attr_t(d);
+    }
+    else if(isdigit && dotcnt == 0) {
+        int64_t i;
+        if(utils::parse_int(val, i)) return gff_attr_t(i);
+    }
+    return gff_attr_t(std::string(val));
 }
 
-bool convert_str_to_double(const std::string &ival, double &oval)
+// load filter check on the tokenized attributes column (last value of a repeated name wins, as in storage)
+static bool match_attrs(const gff_load_filter_t &filter,
+                        const std::vector< std::pair<std::string_view, std::string_view> > &attrlist,
+                        bool onlystrinval)
 {
-    try {
-        oval = std::stod(ival);
-        return true;
+    thread_local std::vector<const std::string_view*> vals;
+    vals.assign(filter.names.size(), nullptr);
+    for(const auto &f: attrlist) {
+        auto name = gff_symbol_t::find(f.first); // names of the filter are interned
+        for(std::size_t i = 0; i < filter.names.size(); ++i) {
+            if(name == filter.names[i]) vals[i] = &f.second;
+        }
     }
-    catch(...) {}
-    return false;
+    for(std::size_t i = 0; i < vals.size(); ++i) {
+        if(!vals[i]) return false;
+        bool eq = onlystrinval ? filter.values[i].contains_string(*vals[i])
+                               : filter.values[i].contains(auto_typed_value(*vals[i]));
+        if(!eq) return false;
+    }
+    return true;
 }
 
-gff_data_t gff_parser_t::parse_line(const std::string &line, std::string &error, uint64_t linenum, bool onlystrinval)
+// calls f(line, linenum) for every line of text, returns the last line number
+template<typename F>
+static uint64_t for_each_line(std::string_view text, uint64_t linenum, F &&f)
 {
-    auto fields = utils::get_fields(line, '\t', false);
-    if(fields.size() != static_cast<int>(gff_field_type_t::FIELDSLEN)) {
+    std::size_t prev = 0;
+    for(;;) {
+        auto it = text.find('\n', prev);
+        f(text.substr(prev, it == std::string_view::npos ? std::string_view::npos : it - prev), linenum);
+        if(it == std::string_view::npos || it + 1 == text.size()) break;
+        prev = it + 1;
+        ++linenum;
+    }
+    return linenum;
+}
+
+// read only memory mapping of a whole file
+class mapped_file_t
+{
+    int _fd = -1;
+    void *_addr = MAP_FAILED;
+    std::size_t _size = 0;
+public:
+    explicit mapped_file_t(const std::string &path) {
+        _fd = ::open(path.c_str(), O_RDONLY);
+        if(_fd < 0) return;
+        struct stat st;
+        if(::fstat(_fd, &st) != 0) return;
+        _size = static_cast<std::size_t>(st.st_size);
+        if(!_size) return;
+        _addr = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+        if(_addr != MAP_FAILED)
+            ::madvise(_addr, _size, MADV_SEQUENTIAL);
+    }
+    ~mapped_file_t() {
+        if(_addr != MAP_FAILED) ::munmap(_addr, _size);
+        if(_fd >= 0) ::close(_fd);
+    }
+    mapped_file_t(const mapped_file_t&) = delete;
+    mapped_file_t& operator=(const mapped_file_t&) = delete;
+    bool is_open() const { return _fd >= 0 && (!_size || _addr != MAP_FAILED); }
+    std::string_view text() const {
+        if(_addr == MAP_FAILED) return {};
+        return std::string_view(static_cast<const char*>(_addr), _size);
+    }
+};
+
+// splits line by delim into at most maxout views, returns the full fields count
+static std::size_t split_fields(std::string_view line, char delim, std::string_view *out, std::size_t maxout)
+{
+    thread_local std::vector<uint32_t> offsets;
+    utils::find_delims(line, std::string_view(&delim, 1), offsets);
+    std::size_t prev = 0;
+    for(std::size_t i = 0; i < offsets.size() && i < maxout; ++i) {
+        out[i] = line.substr(prev, offsets[i] - prev);
+        prev = offsets[i] + 1;
+    }
+    if(offsets.size() < maxout)
+        out[offsets.size()] = line.substr(prev);
+    return offsets.size() + 1;
+}
+
+gff_data_t gff_parser_t::parse_line(std::string_view line, std::string &error, uint64_t linenum, bool onlystrinval,
+                                    const gff_projection_t *projection, const gff_load_filter_t *filter)
+{
+    constexpr std::size_t fields_len = static_cast<std::size_t>(gff_field_type_t::FIELDSLEN);
+    std::string_view fields[fields_len];
+    auto fields_cnt = split_fields(line, '\t', fields, fields_len);
+    if(fields_cnt != fields_len) {
         error = "line#" + std::to_string(linenum) + " wrong line format (fields count '" +
-                 std::to_string(fields.size()) + "' instead of '" +
-                 std::to_string(static_cast<int>(gff_field_type_t::FIELDSLEN)) + "')";
+                 std::to_string(fields_cnt) + "' instead of '" +
+                 std::to_string(fields_len) + "')";
         return gff_data_t();
     }
+    // filtered out lines are skipped before any conversion
+    if(filter) {
+        if(!filter->any_type && gff_symbol_t::find(fields[(int)gff_field_type_t::TYPE]) != filter->type)
+            return gff_data_t();
+        if(!filter->any_source && gff_symbol_t::find(fields[(int)gff_field_type_t::SOURCE]) != filter->source)
+            return gff_data_t();
+    }
 
     gff_data_t linedata;
     linedata.linenum = linenum;
 
-    linedata.position.seqid = fields[(int)gff_field_type_t::SEQID];
-    linedata.source = fields[(int)gff_field_type_t::SOURCE];
-    linedata.type = fields[(int)gff_field_type_t::TYPE];
+    linedata.position.seqid = gff_symbol_t(fields[(int)gff_field_type_t::SEQID]);
+    linedata.source = gff_symbol_t(fields[(int)gff_field_type_t::SOURCE]);
+    linedata.type = gff_symbol_t(fields[(int)gff_field_type_t::TYPE]);
 
-    std::string start_s = utils::trim(fields[(int)gff_field_type_t::START]);
-    std::string end_s = utils::trim(fields[(int)gff_field_type_t::END]);
-    std::string score_s = utils::trim(fields[(int)gff_field_type_t::SCORE]);
+    auto start_s = utils::trim_view(fields[(int)gff_field_type_t::START]);
+    auto end_s = utils::trim_view(fields[(int)gff_field_type_t::END]);
+    auto score_s = utils::trim_view(fields[(int)gff_field_type_t::SCORE]);
 
     if(utils::check_no_data(start_s) || !convert_str_to_uint64(start_s, linedata.position.start)) {
         error = "line#" + std::to_string(linenum) + " wrong 'start' field";
@@ -248,8 +601,8 @@ gff_data_t gff_parser_t::parse_line(const std::string &line, std::string &error,
         return gff_data_t();
     }
 
-    std::string strand_s = utils::trim(fields[(int)gff_field_type_t::STRAND]);
-    std::string phase_s = utils::trim(fields[(int)gff_field_type_t::PHASE]);
+    auto strand_s = utils::trim_view(fields[(int)gff_field_type_t::STRAND]);
+    auto phase_s = utils::trim_view(fields[(int)gff_field_type_t::PHASE]);
 
     if(!utils::check_no_data(strand_s)) {
         if(strand_s.size() != 1) {
@@ -266,14 +619,32 @@ gff_data_t gff_parser_t::parse_line(const std::string &line, std::string &error,
         linedata.phase = phase_s[0];
     }
 
-    auto attrlist = utils::get_subfields(utils::trim(fields[(int)gff_field_type_t::ATTRIBUTES]), ';', '=', error, true);
+    auto attrcol = utils::trim_view(fields[(int)gff_field_type_t::ATTRIBUTES]);
+    auto attrlist = utils::get_subfields_view(attrcol, ';', '=', error, true);
     if(!error.empty()) {
         error = "line#" + std::to_string(linenum) + " " + error;
         return gff_data_t();
     }
+    if(filter && !filter->names.empty() && !match_attrs(*filter, attrlist, onlystrinval))
+        return gff_data_t();
+    if(projection && !projection->all) {
+        if(projection->keep_raw) linedata.raw_attributes = attrcol;
+        std::size_t cnt = 0;
+        for(const auto &attr: attrlist) {
+            if(projection->wants(gff_symbol_t::find(attr.first))) ++cnt;
+        }
+        linedata.attributes.reserve(cnt);
+    }
+    else linedata.attributes.reserve(attrlist.size());
     for(const auto &attr: attrlist) {
-        if(onlystrinval) linedata.set_attr(attr.first, attr.second);
-        else linedata.set_attr_auto(attr.first, attr.second);
+        gff_symbol_t name;
+        if(projection && !projection->all) { // wanted names are interned already
+            name = gff_symbol_t::find(attr.first);
+            if(!projection->wants(name)) continue;
+        }
+        else name = gff_symbol_t(attr.first);
+        if(onlystrinval) linedata.set_attr(name, std::string(attr.second));
+        else linedata.set_attr_auto(name, attr.second);
     }
     return linedata;
 }
@@ -322,23 +693,421 @@ gff_parser_t &gff_parser_t::operator<<(const std::string &line)
         }
     }
     if(line.at(0) == '#') return *this; // this is comment
+    _indexed = false;
     if(_thrpool) {
         _thrpool->push(line, _linenum);
         return *this;
     }
-    auto linedata = parse_line(line, _error, _linenum, _onlystrval);
+    auto linedata = parse_line(line, _error, _linenum, _onlystrval, &_projection, &_filter);
     if(!linedata.empty())
         _data.push_back(std::move(linedata));
     return *this;
 }
 
+void gff_parser_t::load_file(const std::string &path, std::vector<gff_seqid_block_t> *blocks)
+{
+    mapped_file_t mf(path);
+    if(!mf.is_open()) {
+        _error = "can't open '" + path + "'";
+        return;
+    }
+    auto text = mf.text();
+    std::size_t prev = 0;
+    // header lines go through the common path (gff-version check)
+    while(prev < text.size() && !_gff_version && !has_error()) {
+        auto it = text.find('\n', prev);
+        if(it == std::string_view::npos) it = text.size();
+        *this << std::string(text.substr(prev, it - prev));
+        prev = it + 1;
+    }
+    if(prev >= text.size() || !_error.empty())
+        return;
+    const uint64_t base = prev;
+    text = text.substr(prev);
+    // a new seqid block starts at a data line with another seqid than the last one
+    auto note_line = [blocks, base](std::string_view line, std::size_t offset, uint64_t lnum) {
+        if(line.empty() || line[0] == '#') return;
+        auto seqid = line.substr(0, line.find('\t'));
+        if(!blocks->empty() && blocks->back().seqid == seqid) return;
+        if(!blocks->empty()) blocks->back().end = base + offset;
+        blocks->push_back(gff_seqid_block_t{std::string(seqid), base + offset, 0, lnum});
+    };
+    _indexed = false;
+    if(!_thrpool) {
+        _linenum = for_each_line(text, _linenum + 1, [&](std::string_view line, uint64_t lnum) {
+            if(blocks) note_line(line, static_cast<std::size_t>(line.data() - text.data()), lnum);
+            if(line.empty() || line[0] == '#' || !_error.empty()) return;
+            auto linedata = parse_line(line, _error, lnum, _onlystrval, &_projection, &_filter);
+            if(!linedata.empty())
+                _data.push_back(std::move(linedata));
+        });
+    }
+    else {
+        // cut newline aligned blocks of chunk_size() lines and hand them to the workers
+        prev = 0;
+        while(prev < text.size() && !_thrpool->has_error()) {
+            auto lines = _thrpool->chunk_size();
+            auto end = prev;
+            std::size_t cnt = 0;
+            while(cnt < lines && end < text.size()) {
+                auto nl = static_cast<const char*>(std::memchr(text.data() + end, '\n', text.size() - end));
+                auto next = nl ? static_cast<std::size_t>(nl - text.data()) + 1 : text.size();
+                if(blocks) note_line(text.substr(end, (nl ? next - 1 : next) - end), end, _linenum + cnt + 1);
+                end = next;
+                ++cnt;
+            }
+            _thrpool->push_block(text.substr(prev, end - prev), _linenum + 1);
+            _linenum += cnt;
+            prev = end;
+        }
+        _thrpool->flush(); // mapping must outlive the workers
+    }
+    if(blocks && !blocks->empty())
+        blocks->back().end = base + text.size();
+}
+
+// snapshot file: header + payload (string table, records, indexes), host byte order
+static constexpr char snapshot_magic[8] = {'G', 'F', 'F', '3', 'S', 'N', 'A', 'P'};
+static constexpr uint32_t snapshot_version = 1;
+static constexpr uint32_t snapshot_byteorder = 0x01020304;
+
+struct snapshot_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    uint64_t payload_size;
+    uint64_t checksum;
+    uint64_t linenum;
+    uint32_t gff_version;
+    uint32_t onlystrval;
+};
+
+static uint64_t snapshot_checksum(std::string_view data)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    std::size_t i = 0;
+    for(; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+        uint64_t w;
+        std::memcpy(&w, data.data() + i, sizeof(w));
+        h = (h ^ w) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    for(; i < data.size(); ++i)
+        h = (h ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ULL;
+    return h;
+}
+
+class snapshot_writer_t
+{
+    std::string _strings;
+    uint32_t _strcnt = 0;
+    std::unordered_map<std::string, uint32_t> _strids;
+public:
+    std::string body;
+    template<typename T>
+    void put(T val) {
+        body.append(reinterpret_cast<const char*>(&val), sizeof(T));
+    }
+    void put_str(const std::string &str) {
+        auto it = _strids.find(str);
+        if(it == _strids.end()) {
+            it = _strids.emplace(str, _strcnt++).first;
+            uint32_t len = static_cast<uint32_t>(str.size());
+            _strings.append(reinterpret_cast<const char*>(&len), sizeof(len));
+            _strings.append(str);
+        }
+        put<uint32_t>(it->second);
+    }
+    std::string payload() const {
+        std::string r(reinterpret_cast<const char*>(&_strcnt), sizeof(_strcnt));
+        r.reserve(sizeof(_strcnt) + _strings.size() + body.size());
+        r += _strings;
+        r += body;
+        return r;
+    }
+};
+
+class snapshot_reader_t
+{
+    std::string_view _data;
+    std::size_t _pos = 0;
+    bool _ok = true;
+    std::vector<std::string_view> _strings;
+public:
+    explicit snapshot_reader_t(std::string_view data): _data(data) {}
+    template<typename T>
+    T get() {
+        T val{};
+        if(!_ok || _pos + sizeof(T) > _data.size()) {
+            _ok = false;
+            return val;
+        }
+        std::memcpy(&val, _data.data() + _pos, sizeof(T));
+        _pos += sizeof(T);
+        return val;
+    }
+    void read_strings() {
+        auto cnt = get<uint32_t>();
+        _strings.reserve(std::min<std::size_t>(cnt, _data.size()));
+        for(uint32_t i = 0; i < cnt && _ok; ++i) {
+            auto len = get<uint32_t>();
+            if(_pos + len > _data.size()) {
+                _ok = false;
+                break;
+            }
+            _strings.push_back(_data.substr(_pos, len));
+            _pos += len;
+        }
+    }
+    std::string_view get_str() {
+        auto id = get<uint32_t>();
+        if(id >= _strings.size()) {
+            _ok = false;
+            return {};
+        }
+        return _strings[id];
+    }
+    // record id, checked against the records count
+    uint32_t get_id(std::size_t cnt) {
+        auto id = get<uint32_t>();
+        if(id >= cnt) _ok = false;
+        return _ok ? id : 0;
+    }
+    void fail() { _ok = false; }
+    bool ok() const { return _ok; }
+    bool at_end() const { return _pos == _data.size(); }
+};
+
+bool gff_parser_t::is_snapshot(const std::string &path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    char magic[sizeof(snapshot_magic)];
+    ifs.read(magic, sizeof(magic));
+    return ifs && std::memcmp(magic, snapshot_magic, sizeof(magic)) == 0;
+}
+
+void gff_parser_t::save_snapshot(const std::string &path)
+{
+    flush();
+    if(has_error()) return;
+    if(!_projection.all) {
+        _error = "snapshot of a projected load would miss attributes";
+        return;
+    }
+    if(!_filter.empty()) {
+        _error = "snapshot of a filtered load would miss records";
+        return;
+    }
+    if(!_lazy.empty()) {
+        _error = "snapshot of a lazy load would miss records";
+        return;
+    }
+    snapshot_writer_t w;
+    auto put_ids = [&](const uint32_t *first, const uint32_t *last) {
+        w.put<uint64_t>(static_cast<uint64_t>(last - first));
+        for(; first != last; ++first)
+            w.put<uint32_t>(*first);
+    };
+    w.put<uint64_t>(_data.size());
+    for(const auto &d: _data) {
+        w.put_str(d.position.seqid.str());
+        w.put_str(d.source.str());
+        w.put_str(d.type.str());
+        w.put<uint64_t>(d.position.start);
+        w.put<uint64_t>(d.position.end);
+        w.put<double>(d.score);
+        w.put<char>(d.strand);
+        w.put<char>(d.phase);
+        w.put<uint64_t>(d.linenum);
+        w.put<uint32_t>(static_cast<uint32_t>(d.attributes.size()));
+        for(const auto &a: d.attributes) {
+            w.put_str(a.first.str());
+            if(a.second.is_integer()) {
+                w.put<uint8_t>(1);
+                w.put<int64_t>(a.second.get_integer());
+            }
+            else if(a.second.is_float()) {
+                w.put<uint8_t>(2);
+                w.put<double>(a.second.get_float());
+            }
+            else {
+                w.put<uint8_t>(0);
+                w.put_str(a.second.get_string());
+            }
+        }
+    }
+    w.put<uint32_t>(static_cast<uint32_t>(_data_by_seqid.size()));
+    for(const auto &s: _data_by_seqid) {
+        w.put_str(s.first.str());
+        const auto &ids = s.second.ids();
+        put_ids(ids.data(), ids.data() + ids.size());
+        for(const auto &e: s.second.maxend())
+            w.put<uint64_t>(e);
+        w.put<int32_t>(s.second.maxlevel());
+    }
+    for(const auto *idx: {&_data_by_source, &_data_by_type}) {
+        w.put<uint32_t>(static_cast<uint32_t>(idx->size()));
+        for(const auto &g: idx->groups()) {
+            w.put_str(g.first.str());
+            put_ids(idx->ids().data() + g.second.first, idx->ids().data() + g.second.second);
+        }
+    }
+
+    auto payload = w.payload();
+    snapshot_header_t hdr;
+    std::memcpy(hdr.magic, snapshot_magic, sizeof(hdr.magic));
+    hdr.version = snapshot_version;
+    hdr.byteorder = snapshot_byteorder;
+    hdr.payload_size = payload.size();
+    hdr.checksum = snapshot_checksum(payload);
+    hdr.linenum = _linenum;
+    hdr.gff_version = static_cast<uint32_t>(_gff_version);
+    hdr.onlystrval = _onlystrval;
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    ofs.write(payload.data(), payload.size());
+    if(!ofs) _error = "can't write snapshot '" + path + "'";
+}
+
+void gff_parser_t::load_snapshot(const std::string &path)
+{
+    mapped_file_t mf(path);
+    if(!mf.is_open()) {
+        _error = "can't open '" + path + "'";
+        return;
+    }
+    auto text = mf.text();
+    snapshot_header_t hdr;
+    if(text.size() < sizeof(hdr)) {
+        _error = "'" + path + "' is not a gff snapshot";
+        return;
+    }
+    std::memcpy(&hdr, text.data(), sizeof(hdr));
+    if(std::memcmp(hdr.magic, snapshot_magic, sizeof(hdr.magic)) != 0) {
+        _error = "'" + path + "' is not a gff snapshot";
+        return;
+    }
+    if(hdr.version != snapshot_version || hdr.byteorder != snapshot_byteorder) {
+        _error = "incompatible gff snapshot version ('" + std::to_string(hdr.version) + "' instead of '" +
+                 std::to_string(snapshot_version) + "'), rebuild it";
+        return;
+    }
+    if((hdr.onlystrval != 0) != _onlystrval) {
+        _error = "gff snapshot '" + path + "' is built with " + (hdr.onlystrval ? "string only" : "typed") +
+                 " attribute values, the load expects " + (_onlystrval ? "string only" : "typed") + " ones";
+        return;
+    }
+    auto payload = text.substr(sizeof(hdr));
+    if(payload.size() != hdr.payload_size || snapshot_checksum(payload) != hdr.checksum) {
+        _error = "gff snapshot '" + path + "' is corrupted (checksum error)";
+        return;
+    }
+
+    snapshot_reader_t r(payload);
+    r.read_strings();
+    auto cnt = r.get<uint64_t>();
+    _data.clear();
+    _data_by_seqid.clear();
+    _data_by_source.clear();
+    _data_by_type.clear();
+    if(cnt > payload.size()) r.fail();
+    _data.resize(r.ok() ? cnt : 0);
+    for(auto &d: _data) {
+        d.position.seqid = gff_symbol_t(r.get_str());
+        d.source = gff_symbol_t(r.get_str());
+        d.type = gff_symbol_t(r.get_str());
+        d.position.start = r.get<uint64_t>();
+        d.position.end = r.get<uint64_t>();
+        d.score = r.get<double>();
+        d.strand = r.get<char>();
+        d.phase = r.get<char>();
+        d.linenum = r.get<uint64_t>();
+        auto acnt = r.get<uint32_t>();
+        if(_projection.all) d.attributes.reserve(std::min<uint32_t>(acnt, 256));
+        for(uint32_t i = 0; i < acnt && r.ok(); ++i) {
+            auto namestr = r.get_str();
+            gff_symbol_t name = _projection.all ? gff_symbol_t(namestr) : gff_symbol_t::find(namestr);
+            bool wanted = _projection.wants(name);
+            auto kind = r.get<uint8_t>();
+            if(kind == 1) {
+                auto v = r.get<int64_t>();
+                if(wanted) d.set_attr(name, v);
+            }
+            else if(kind == 2) {
+                auto v = r.get<double>();
+                if(wanted) d.set_attr(name, v);
+            }
+            else {
+                auto v = r.get_str();
+                if(wanted) d.set_attr(name, std::string(v));
+            }
+        }
+        if(!r.ok()) break;
+    }
+    auto get_ids = [&]() {
+        auto n = r.get<uint64_t>();
+        std::vector<uint32_t> ids;
+        if(n > _data.size()) {
+            r.fail();
+            return ids;
+        }
+        ids.reserve(n);
+        for(uint64_t i = 0; i < n && r.ok(); ++i)
+            ids.push_back(r.get_id(_data.size()));
+        return ids;
+    };
+    auto nseqid = r.get<uint32_t>();
+    for(uint32_t i = 0; i < nseqid && r.ok(); ++i) {
+        gff_symbol_t seqid(r.get_str());
+        auto ids = get_ids();
+        std::vector<uint64_t> maxend(ids.size());
+        for(auto &e: maxend)
+            e = r.get<uint64_t>();
+        auto maxlevel = r.get<int32_t>();
+        if(r.ok() && !_data_by_seqid[seqid].assign(_data.data(), std::move(ids), std::move(maxend), maxlevel))
+            r.fail();
+    }
+    for(auto *idx: {&_data_by_source, &_data_by_type}) {
+        auto n = r.get<uint32_t>();
+        for(uint32_t i = 0; i < n && r.ok(); ++i) {
+            gff_symbol_t name(r.get_str());
+            idx->add(name, get_ids());
+        }
+    }
+    if(!r.ok() || !r.at_end()) {
+        _error = "gff snapshot '" + path + "' is corrupted (wrong format)";
+        _data.clear();
+        _data_by_seqid.clear();
+        _data_by_source.clear();
+        _data_by_type.clear();
+        _columns.clear();
+        return;
+    }
+    _linenum = hdr.linenum;
+    _gff_version = static_cast<int>(hdr.gff_version);
+    if(!_filter.empty()) { // stored indexes cover all records, drop the filtered out ones and reindex
+        _data.erase(std::remove_if(_data.begin(), _data.end(), [this](const gff_data_t &d) {
+            return !_filter.match(d);
+        }), _data.end());
+        _data.shrink_to_fit();
+        build_indexes();
+        return;
+    }
+    for(auto &a: _data_by_attr)
+        build_attr_index(a.first);
+    _columns.build(_data);
+    _indexed = true;
+}
+
 bool gff_parser_t::has_error() const
 {
-    return !_error.empty();
+    return !_error.empty() || (_thrpool && _thrpool->has_error());
 }
 
 std::string gff_parser_t::error() const
 {
+    if(_error.empty() && _thrpool && _thrpool->has_error())
+        return _thrpool->error(); // workers are still running, read under their lock
     return _error;
 }
 
@@ -354,10 +1123,12 @@ uint64_t gff_parser_t::linenum() const
 
 void gff_parser_t::flush()
 {
-    if(!_data_by_seqid.empty() && (!_thrpool || _thrpool->empty()))
+    if(_indexed && (!_thrpool || _thrpool->empty()))
         return;
     if(_thrpool) {
         _thrpool->flush();
+        if(_error.empty() && _thrpool->has_error()) // workers are idle, merge their error
+            _error = _thrpool->error();
         _data.clear();
          auto pooldata = _thrpool->data();
         std::size_t osize = 0;
@@ -369,23 +1140,34 @@ void gff_parser_t::flush()
             _data.insert(_data.end(), std::make_move_iterator(t.data.begin()), std::make_move_iterator(t.data.end()));
         _thrpool->data().clear();
     }
+    build_indexes();
+}
+
+void gff_parser_t::build_indexes()
+{
     _data_by_seqid.clear();
     _data_by_source.clear();
     _data_by_type.clear();
-    for(auto &d: _data) {
-        auto fseqid = _data_by_seqid.find(d.position.seqid);
-        auto fsource = _data_by_source.find(d.source);
-        auto ftype = _data_by_type.find(d.type);
-
-        if(fseqid == _data_by_seqid.end()) _data_by_seqid[d.position.seqid] = { &d };
-        else _data_by_seqid[d.position.seqid].push_back(&d);
-
-        if(fsource == _data_by_source.end()) _data_by_source[d.source] = { &d };
-        else _data_by_source[d.source].push_back(&d);
-
-        if(ftype == _data_by_type.end()) _data_by_type[d.type] = { &d };
-        else _data_by_type[d.type].push_back(&d);
+    // id groups by a counting pass over the columns
+    _columns.build(_data);
+    _data_by_source.build(_columns.source);
+    _data_by_type.build(_columns.type);
+    gff_id_index_t by_seqid;
+    by_seqid.build(_columns.seqid);
+    for(const auto &g: by_seqid.groups()) {
+        std::vector<uint32_t> ids(by_seqid.ids().begin() + g.second.first, by_seqid.ids().begin() + g.second.second);
+        _data_by_seqid[g.first].build(_data.data(), std::move(ids));
     }
+    // lazy seqids have their entries before the queries (no map changes while querying)
+    for(auto &l: _lazy) {
+        std::vector<uint32_t> ids(l.second->data.size());
+        for(std::size_t i = 0; i < ids.size(); ++i)
+            ids[i] = static_cast<uint32_t>(i);
+        _data_by_seqid[l.first].build(l.second->data.data(), std::move(ids));
+    }
+    for(auto &a: _data_by_attr)
+        build_attr_index(a.first);
+    _indexed = true;
 }
 
 std::size_t gff_parser_t::size() const
@@ -408,57 +1190,239 @@ void gff_parser_t::setattr_force_flt(const std::string &field)
     _force_types[field] = force_type_t::ft_flt;
 }
 
-std::vector<gff_data_t *> gff_parser_t::get_by_pos(const gff_postition_t &position)
+void gff_parser_t::set_seqid_loader(const std::vector<std::string> &seqids, seqid_loader_t loader)
 {
-    if(_data_by_seqid.empty()) flush();
-    std::vector<gff_data_t *> r;
-    auto it = _data_by_seqid.find(position.seqid);
-    if(it == _data_by_seqid.end()) return r;
-    if(position.singlepos()) {
-        for(auto &data: it->second) {
-            if(data->position.in(position.seqid, position.start))
-                r.push_back(data);
-        }
+    _seqid_loader = std::move(loader);
+    for(const auto &seqid: seqids) {
+        gff_symbol_t sym(seqid);
+        if(_lazy.count(sym)) continue;
+        _lazy.emplace(sym, std::unique_ptr<lazy_seqid_t>(new lazy_seqid_t));
+        _data_by_seqid[sym];
     }
-    else {
-        for(auto &data: it->second) {
-            if(data->position.intersect(position.seqid, position.start, position.end))
-                r.push_back(data);
-        }
+}
+
+// interval index of a seqid, a lazy seqid block is parsed on the first use (thread safe)
+const gff_interval_index_t *gff_parser_t::find_seqid(gff_symbol_t seqid)
+{
+    auto lz = _lazy.find(seqid);
+    if(lz != _lazy.end()) {
+        auto &lazy = *lz->second;
+        std::call_once(lazy.once, [&]() { load_seqid(seqid, lazy); });
+        if(!lazy.error.empty())
+            throw std::runtime_error(lazy.error);
+    }
+    auto it = _data_by_seqid.find(seqid);
+    if(it == _data_by_seqid.end()) return nullptr;
+    return &it->second;
+}
+
+void gff_parser_t::load_seqid(gff_symbol_t seqid, lazy_seqid_t &lazy)
+{
+    std::vector<gff_text_block_t> blocks;
+    std::string error;
+    if(!_seqid_loader(seqid.str(), blocks, error)) {
+        lazy.error = error.empty() ? "can't load seqid '" + seqid.str() + "'" : error;
+        return;
     }
+    for(const auto &block: blocks) {
+        for_each_line(block.text, block.linenum, [&](std::string_view line, uint64_t lnum) {
+            if(line.empty() || line[0] == '#' || !error.empty()) return;
+            auto linedata = parse_line(line, error, lnum, _onlystrval, &_projection, &_filter);
+            if(!linedata.empty() && linedata.position.seqid == seqid)
+                lazy.data.push_back(std::move(linedata));
+        });
+    }
+    if(!error.empty()) {
+        lazy.data.clear();
+        lazy.error = "seqid '" + seqid.str() + "' block: " + error;
+        return;
+    }
+    std::vector<uint32_t> ids(lazy.data.size());
+    for(std::size_t i = 0; i < ids.size(); ++i)
+        ids[i] = static_cast<uint32_t>(i);
+    _data_by_seqid.find(seqid)->second.build(lazy.data.data(), std::move(ids));
+}
+
+const gff_interval_index_t *gff_parser_t::index_by_seqid(std::string_view seqid)
+{
+    if(!_indexed) flush();
+    return find_seqid(gff_symbol_t::find(seqid));
+}
+
+void gff_parser_t::overlap(std::string_view seqid, uint64_t start, uint64_t end, const gff_filter_t &filter, std::vector<gff_data_t *> &out)
+{
+    out.clear();
+    auto index = index_by_seqid(seqid);
+    if(!index) return;
+    index->for_each_overlap(start, end, [&](std::size_t i) {
+        auto *d = index->item(i);
+        if(filter.match(*d)) out.push_back(d);
+    });
+    std::sort(out.begin(), out.end()); // file order
+}
+
+std::vector<gff_data_t *> gff_parser_t::get_by_pos(const gff_postition_t &position)
+{
+    if(!_indexed) flush();
+    std::vector<gff_data_t *> r;
+    auto index = find_seqid(gff_symbol_t::find(position.seqid));
+    if(!index) return r;
+    index->overlap(position.start, position.end, r);
     return r;
 }
 
 std::vector<gff_data_t *> gff_parser_t::get_by_type(const std::string &type)
 {
-    if(_data_by_type.empty()) flush();
-    auto it = _data_by_type.find(type);
-    if(it == _data_by_type.end()) return {};
-    return it->second;
+    if(!_indexed) flush();
+    auto range = _data_by_type.find(gff_symbol_t::find(type));
+    std::vector<gff_data_t *> r;
+    r.reserve(range.second - range.first);
+    for(auto i = range.first; i < range.second; ++i)
+        r.push_back(&_data[_data_by_type.ids()[i]]);
+    return r;
 }
 
-bool check_attrs(const std::vector<gff_attribute_t> &attr, const gff_data_t &data)
+// позиция + тип, позиция + тип + аттрибут или позиция + аттрибут
+// symbols are interned: lazily loaded records may bring them later
+gff_filter_t::gff_filter_t(const std::string &type, const std::vector<gff_attribute_t> &attr)
+    : any_type(type.empty()), type(type)
 {
-    bool eq = true;
     for(const auto &a: attr) {
-        eq = data.eq_attr(a.name, a.value);
-        if(!eq) {
-            for(auto &orv: a.orvalues) {
-                eq = data.eq_attr(a.name, orv);
-                if(eq) break;
-            }
+        names.push_back(gff_symbol_t(a.name));
+        values.push_back(gff_value_set_t(a));
+    }
+}
+
+bool gff_filter_t::match(const gff_data_t &data) const
+{
+    if(!any_type && data.type != type) return false;
+    for(std::size_t i = 0; i < names.size(); ++i) {
+        auto it = data.attributes.find(names[i]);
+        if(it == data.attributes.end() || !values[i].contains(it->second)) return false;
+    }
+    return true;
+}
+
+gff_value_set_t::gff_value_set_t(const gff_attribute_t &attr)
+{
+    _values.reserve(attr.orvalues.size() + 1);
+    _values.push_back(attr.value);
+    _values.insert(_values.end(), attr.orvalues.begin(), attr.orvalues.end());
+    if(_values.size() < hash_min) return;
+    std::size_t size = 16;
+    while(size < _values.size() * 2) size <<= 1;
+    _slots.assign(size, 0);
+    _mask = size - 1;
+    for(std::size_t i = 0; i < _values.size(); ++i) {
+        if(!_values[i].is_string()) continue;
+        auto h = std::hash<std::string_view>()(_values[i].get_string()) & _mask;
+        while(_slots[h]) h = (h + 1) & _mask;
+        _slots[h] = static_cast<uint32_t>(i + 1);
+    }
+}
+
+bool gff_value_set_t::contains(const gff_attr_t &val) const
+{
+    if(val.is_string()) return contains_string(val.get_string());
+    for(const auto &v: _values)
+        if(v.eq(val)) return true;
+    return false;
+}
+
+bool gff_value_set_t::contains_string(std::string_view val) const
+{
+    if(_slots.empty()) {
+        for(const auto &v: _values)
+            if(v.is_string() && v.get_string() == val) return true;
+        return false;
+    }
+    for(auto h = std::hash<std::string_view>()(val) & _mask; _slots[h]; h = (h + 1) & _mask) {
+        if(_values[_slots[h] - 1].get_string() == val) return true;
+    }
+    return false;
+}
+
+// value key of the inverted index, type is a part of the key (as in gff_attr_t::eq);
+// -0.0 and 0.0 are equal values, every NaN has one key (candidates are checked by eq anyway)
+static std::string attr_key(const gff_attr_t &val)
+{
+    if(val.is_integer()) return "i" + std::to_string(val.get_integer());
+    if(val.is_float()) {
+        double v = val.get_float();
+        if(v == 0.0) v = 0.0;
+        else if(std::isnan(v)) v = std::numeric_limits<double>::quiet_NaN();
+        return "f" + std::string(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+    return "s" + val.get_string();
+}
+
+void gff_parser_t::index_attr(const std::string &name)
+{
+    if(!_indexed) flush();
+    build_attr_index(gff_symbol_t(name));
+}
+
+void gff_parser_t::build_attr_index(gff_symbol_t name)
+{
+    auto &idx = _data_by_attr[name];
+    idx.clear();
+    for(std::size_t i = 0; i < _data.size(); ++i) {
+        auto it = _data[i].attributes.find(name);
+        if(it != _data[i].attributes.end())
+            idx[attr_key(it->second)].push_back(static_cast<uint32_t>(i));
+    }
+}
+
+// candidate record ids (ascending) from the indexed attributes, false if no one is indexed
+bool gff_parser_t::attr_candidates(const std::vector<gff_attribute_t> &attr, std::vector<uint32_t> &ids) const
+{
+    bool found = false;
+    std::vector<uint32_t> any, tmp;
+    for(const auto &a: attr) {
+        auto idx = _data_by_attr.find(gff_symbol_t::find(a.name));
+        if(idx == _data_by_attr.end()) continue;
+        any.clear();
+        auto add_value = [&](const gff_attr_t &v) {
+            auto pl = idx->second.find(attr_key(v));
+            if(pl == idx->second.end()) return;
+            tmp.clear();
+            std::set_union(any.begin(), any.end(), pl->second.begin(), pl->second.end(), std::back_inserter(tmp));
+            std::swap(any, tmp);
+        };
+        add_value(a.value);
+        for(const auto &orv: a.orvalues)
+            add_value(orv);
+        if(!found) {
+            std::swap(ids, any);
+            found = true;
         }
-        if(!eq) break;
+        else {
+            tmp.clear();
+            std::set_intersection(ids.begin(), ids.end(), any.begin(), any.end(), std::back_inserter(tmp));
+            std::swap(ids, tmp);
+        }
+        if(ids.empty()) break;
     }
-    return eq;
+    return found;
 }
 
 std::vector<gff_data_t *> gff_parser_t::get_by_attr(const std::vector<gff_attribute_t> &attr)
 {
+    if(!_indexed) flush();
     std::vector<gff_data_t *> r;
-    for(auto &data: _data) {
-        if(check_attrs(attr, data))
-            r.push_back(&data);
+    std::vector<uint32_t> ids;
+    gff_filter_t filter("", attr);
+    if(attr_candidates(attr, ids)) {
+        for(auto id: ids) {
+            if(filter.match(_data[id]))
+                r.push_back(&_data[id]);
+        }
+        return r;
+    }
+    // records without the attribute names are skipped on the name column
+    for(std::size_t id = 0; id < _columns.size(); ++id) {
+        if(_columns.has_attrs(id, filter.names) && filter.match(_data[id]))
+            r.push_back(&_data[id]);
     }
     return r;
 }
@@ -466,40 +1430,55 @@ std::vector<gff_data_t *> gff_parser_t::get_by_attr(const std::vector<gff_attrib
 std::vector<gff_data_t *> gff_parser_t::get_by(const std::string &type, const std::vector<gff_attribute_t> &attr, const gff_postition_t &position)
 {
     if(type.empty() && attr.empty() && position.empty()) return {}; // нет параметров
-    if(!type.empty() && attr.empty() && position.empty()) return get_by_type(type); // только первый
-    if(type.empty() && !attr.empty() && position.empty()) return get_by_attr(attr); // только второй
     if(type.empty() && attr.empty() && !position.empty()) return get_by_pos(position); // только третий
     std::vector<gff_data_t *> r;
+    gff_filter_t filter(type, attr);
     if(!position.empty()) { // есть позиция
-        if(_data_by_seqid.empty()) flush();
-        auto it = _data_by_seqid.find(position.seqid);
-        if(it == _data_by_seqid.end()) return r;
-        for(auto &d: it->second) {
-            if(position.singlepos()) {
-                if(!d->position.in(position.start)) continue;
-            }
-            else {
-                if(!d->position.intersect(position.start, position.end)) continue;
+        overlap(position.seqid, position.start, position.end, filter, r);
+        return r;
+    }
+    if(!type.empty() && attr.empty()) { // только первый
+        r = get_by_type(type);
+    }
+    else if(type.empty()) { // только второй
+        r = get_by_attr(attr);
+    }
+    else { // остался только вариант тип + аттрибут
+        if(!_indexed) flush();
+        std::vector<uint32_t> ids;
+        if(attr_candidates(attr, ids)) {
+            for(auto id: ids) {
+                if(filter.match(_data[id]))
+                    r.push_back(&_data[id]);
             }
-            if(!type.empty() && d->type != type) continue; // позиция + тип
-            if(!attr.empty()) { // позиция + тип + аттрибут или позиция + аттрибут
-                if(!check_attrs(attr, *d))
-                    continue;
+        }
+        else {
+            auto range = _data_by_type.find(filter.type);
+            for(auto i = range.first; i < range.second; ++i) {
+                auto id = _data_by_type.ids()[i];
+                if(_columns.has_attrs(id, filter.names) && filter.match(_data[id]))
+                    r.push_back(&_data[id]);
             }
-            r.push_back(d);
         }
-        return r;
-    }
-    // остался только вариант тип + аттрибут
-    if(_data_by_type.empty()) flush();
-    auto it = _data_by_type.find(type);
-    if(it == _data_by_type.end()) return r;
-    for(auto &d: it->second) {
-        if(check_attrs(attr, *d)) r.push_back(d);
     }
+    lazy_matches(filter, r);
     return r;
 }
 
+// adds the records of all lazy seqids matching the filter (each seqid is loaded), r is kept in file order
+void gff_parser_t::lazy_matches(const gff_filter_t &filter, std::vector<gff_data_t *> &r)
+{
+    if(_lazy.empty()) return;
+    for(auto &l: _lazy) {
+        find_seqid(l.first); // a block error is thrown as by the position queries
+        for(auto &d: l.second->data) {
+            if(filter.match(d))
+                r.push_back(&d);
+        }
+    }
+    std::sort(r.begin(), r.end(), [](const gff_data_t *a, const gff_data_t *b) { return a->linenum < b->linenum; });
+}
+
 std::vector<gff_data_t *> gff_parser_t::get_by(const std::string &type, const std::vector<gff_attribute_t> &attr)
 {
     return get_by(type, attr, gff_postition_t());
@@ -515,12 +1494,198 @@ std::vector<gff_data_t *> gff_parser_t::get_by(const std::vector<gff_attribute_t
     return get_by("", attr, position);
 }
 
+// read hint for a record touched soon
+static inline void prefetch(const void *p)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+}
+
+// the query is answered by the interval tree: every item overlapping it is active,
+// items started after its end are activated by the sweep
+void gff_sweep_t::seed(uint64_t start, uint64_t end)
+{
+    _active.clear();
+    _index->for_each_overlap(start, end, [&](std::size_t i) { _active.push_back(static_cast<uint32_t>(i)); });
+    _next = _index->upper_bound(end);
+    _seeded = true;
+}
+
+void gff_sweep_t::overlap(std::string_view seqid, uint64_t start, uint64_t end, const gff_filter_t &filter, std::vector<gff_data_t *> &out)
+{
+    out.clear();
+    if(start > end) return;
+    if(!_index || seqid != _seqid) {
+        _seqid = seqid;
+        _index = _gff->index_by_seqid(_seqid);
+        _seeded = false;
+    }
+    if(!_index) return;
+    if(!_seeded || start < _lastpos ||
+       (_next + reseed_gap < _index->size() && _index->start(_next + reseed_gap) < start)) {
+        seed(start, end);
+    }
+    else {
+        _active.erase(std::remove_if(_active.begin(), _active.end(), [&](uint32_t i) {
+            return _index->end(i) < start;
+        }), _active.end());
+        for(auto n = _index->size(); _next < n && _index->start(_next) <= end; ++_next) {
+            if(_next + prefetch_ahead < n)
+                prefetch(_index->item(_next + prefetch_ahead));
+            if(_index->end(_next) >= start)
+                _active.push_back(static_cast<uint32_t>(_next));
+        }
+    }
+    _lastpos = start;
+    for(auto i: _active) {
+        if(_index->start(i) > end) continue;
+        auto *d = _index->item(i);
+        if(filter.match(*d))
+            out.push_back(d);
+    }
+    std::sort(out.begin(), out.end()); // file order
+}
+
+void gff_parser_t::get_by_batch(const std::vector<gff_query_t> &queries, const gff_filter_t &filter, const batch_sink_t &sink)
+{
+    if(!_indexed) flush();
+    // sort keys: seqid group number (order of appearance) and start
+    struct key_t {
+        uint32_t group;
+        uint32_t query;
+        uint64_t start;
+    };
+    std::vector<key_t> keys(queries.size());
+    std::unordered_map<std::string_view, uint32_t> groups;
+    std::string_view last;
+    uint32_t group = 0;
+    for(std::size_t i = 0; i < queries.size(); ++i) {
+        const auto &q = queries[i];
+        if(i == 0 || q.seqid != last) {
+            last = q.seqid;
+            group = groups.emplace(last, static_cast<uint32_t>(groups.size())).first->second;
+        }
+        keys[i] = {group, static_cast<uint32_t>(i), q.start};
+    }
+    auto less = [](const key_t &a, const key_t &b) {
+        return a.group != b.group ? a.group < b.group : a.start < b.start;
+    };
+    if(!std::is_sorted(keys.begin(), keys.end(), less)) // sorted input keeps its order
+        std::sort(keys.begin(), keys.end(), less);
+    gff_sweep_t sweep(*this);
+    std::vector<gff_data_t *> found;
+    for(const auto &k: keys) {
+        const auto &q = queries[k.query];
+        sweep.overlap(q.seqid, q.start, q.end, filter, found);
+        sink(k.query, found);
+    }
+}
+
+std::vector<gff_data_t *> gff_sweep_t::get_by_pos(const gff_postition_t &position)
+{
+    std::vector<gff_data_t *> r;
+    overlap(position.seqid, position.start, position.end, gff_filter_t(), r);
+    return r;
+}
+
+std::vector<gff_data_t *> gff_sweep_t::get_by(const std::string &type, const std::vector<gff_attribute_t> &attr, const gff_postition_t &position)
+{
+    std::vector<gff_data_t *> r;
+    overlap(position.seqid, position.start, position.end, gff_filter_t(type, attr), r);
+    return r;
+}
+
+gff_attr_list_t::const_iterator gff_attr_list_t::find(gff_symbol_t name) const
+{
+    auto it = std::lower_bound(_items.begin(), _items.end(), name,
+        [](const value_type &a, gff_symbol_t n) { return a.first.id < n.id; });
+    if(it == _items.end() || it->first != name) return _items.end();
+    return it;
+}
+
+gff_attr_t &gff_attr_list_t::operator[](gff_symbol_t name)
+{
+    auto it = std::lower_bound(_items.begin(), _items.end(), name,
+        [](const value_type &a, gff_symbol_t n) { return a.first.id < n.id; });
+    if(it == _items.end() || it->first != name)
+        it = _items.insert(it, value_type(name, gff_attr_t()));
+    return it->second;
+}
+
+bool gff_projection_t::wants(gff_symbol_t name) const
+{
+    return all || std::binary_search(names.begin(), names.end(), name,
+        [](gff_symbol_t a, gff_symbol_t b) { return a.id < b.id; });
+}
+
+void gff_load_filter_t::set(const std::string &type, const std::string &source, const std::vector<gff_attribute_t> &attr)
+{
+    any_type = type.empty();
+    this->type = gff_symbol_t(type);
+    any_source = source.empty();
+    this->source = gff_symbol_t(source);
+    names.clear();
+    values.clear();
+    for(const auto &a: attr) {
+        names.push_back(gff_symbol_t(a.name));
+        values.push_back(gff_value_set_t(a));
+    }
+}
+
+bool gff_load_filter_t::match(const gff_data_t &data) const
+{
+    if(!any_type && data.type != type) return false;
+    if(!any_source && data.source != source) return false;
+    for(std::size_t i = 0; i < names.size(); ++i) {
+        auto it = data.attributes.find(names[i]);
+        if(it == data.attributes.end() || !values[i].contains(it->second)) return false;
+    }
+    return true;
+}
+
+void gff_parser_t::set_load_filter(const std::string &type, const std::string &source, const std::vector<gff_attribute_t> &attr)
+{
+    _filter.set(type, source, attr);
+}
+
+void gff_parser_t::set_attr_projection(const std::vector<std::string> &names, bool keep_raw)
+{
+    _projection.all = false;
+    _projection.keep_raw = keep_raw;
+    _projection.names.clear();
+    for(const auto &n: names)
+        _projection.names.push_back(gff_symbol_t(n));
+    std::sort(_projection.names.begin(), _projection.names.end(),
+        [](gff_symbol_t a, gff_symbol_t b) { return a.id < b.id; });
+}
+
+gff_attr_list_t gff_data_t::parse_raw_attrs(bool onlystrval) const
+{
+    if(raw_attributes.empty()) return attributes;
+    gff_data_t tmp;
+    std::string error;
+    for(const auto &attr: utils::get_subfields_view(raw_attributes, ';', '=', error, true)) {
+        gff_symbol_t name(attr.first);
+        if(onlystrval) tmp.set_attr(name, std::string(attr.second));
+        else tmp.set_attr_auto(name, attr.second);
+    }
+    return tmp.attributes;
+}
+
 bool gff_data_t::has_attr(const std::string &name) const
 {
-    return attributes.find(name) != attributes.end();
+    return attributes.find(gff_symbol_t::find(name)) != attributes.end();
 }
 
 bool gff_data_t::eq_attr(const std::string &name, const gff_attr_t &val) const
+{
+    return eq_attr(gff_symbol_t::find(name), val);
+}
+
+bool gff_data_t::eq_attr(gff_symbol_t name, const gff_attr_t &val) const
 {
     auto atri = attributes.find(name);
     if(atri == attributes.end()) return false;
@@ -528,6 +1693,11 @@ bool gff_data_t::eq_attr(const std::string &name, const gff_attr_t &val) const
 }
 
 const gff_attr_t &gff_data_t::get_attr(const std::string &name) const
+{
+    return get_attr(gff_symbol_t::find(name));
+}
+
+const gff_attr_t &gff_data_t::get_attr(gff_symbol_t name) const
 {
     auto fa = attributes.find(name);
     if(fa == attributes.end()) {
@@ -539,38 +1709,40 @@ const gff_attr_t &gff_data_t::get_attr(const std::string &name) const
 
 void gff_data_t::set_attr_auto(const std::string &name, const std::string &val)
 {
-    bool isdigit = true;
-    int dotcnt = 0;
-    for(const auto &c: val) {
-        if(c == '.') {
-            ++dotcnt;
-        }
-        else if(!std::isdigit(c)) {
-            isdigit = false;
-            break;
-        }
-    }
-    try {
-        if(!isdigit || dotcnt > 1) set_attr(name, val);
-        else if(dotcnt == 1) set_attr(name, std::stod(val));
-        else set_attr(name, std::stol(val));
-        return;
-    }
-    catch(...) {}
-    set_attr(name, val);
+    set_attr_auto(gff_symbol_t(name), val);
 }
 
 void gff_data_t::set_attr(const std::string &name, const std::string &val)
 {
-    attributes[name] = gff_attr_t().set_string(val);
+    set_attr(gff_symbol_t(name), val);
 }
 
 void gff_data_t::set_attr(const std::string &name, int64_t val)
 {
-    attributes[name] = gff_attr_t().set_integer(val);
+    set_attr(gff_symbol_t(name), val);
 }
 
 void gff_data_t::set_attr(const std::string &name, double val)
+{
+    set_attr(gff_symbol_t(name), val);
+}
+
+void gff_data_t::set_attr_auto(gff_symbol_t name, std::string_view val)
+{
+    attributes[name] = auto_typed_value(val);
+}
+
+void gff_data_t::set_attr(gff_symbol_t name, const std::string &val)
+{
+    attributes[name] = gff_attr_t().set_string(val);
+}
+
+void gff_data_t::set_attr(gff_symbol_t name, int64_t val)
+{
+    attributes[name] = gff_attr_t().set_integer(val);
+}
+
+void gff_data_t::set_attr(gff_symbol_t name, double val)
 {
     attributes[name] = gff_attr_t().set_float(val);
 }
@@ -578,7 +1750,7 @@ void gff_data_t::set_attr(const std::string &name, double val)
 std::string gff_data_t::str() const
 {
     std::ostringstream ost;
-    ost << "SEQID:" << position.seqid << " SRC:" << source << " TYPE:" << type
+    ost << "SEQID:" << position.seqid.str() << " SRC:" << source.str() << " TYPE:" << type.str()
         << " START:" << position.start << " END:" << position.end
         << " SCORE:" << (score != d_nodata ? std::to_string(score) : "n/a")
         << " STRAND:" << std::string(&strand, 1)
@@ -587,7 +1759,7 @@ std::string gff_data_t::str() const
     auto sz = attributes.size();
     for(const auto &a: attributes) {
         --sz;
-        ost << a.first << ":" << a.second.str();
+        ost << a.first.str() << ":" << a.second.str();
         if(sz) ost << ",";
     }
     ost << ")";
@@ -599,6 +1771,21 @@ bool gff_data_t::empty() const
     return position.empty();
 }
 
+bool gff_location_t::empty() const
+{
+    return seqid.empty();
+}
+
+bool gff_location_t::in(uint64_t pos) const
+{
+    return start <= pos && end >= pos;
+}
+
+bool gff_location_t::intersect(uint64_t spos, uint64_t epos) const
+{
+    return std::max(spos,start) <= std::min(epos, end);
+}
+
 bool gff_postition_t::empty() const
 {
     return seqid.empty();
@@ -640,58 +1827,312 @@ bool gff_postition_t::intersect(const std::string &sid, uint64_t spos, uint64_t
     return seqid == sid && std::max(spos,start) <= std::min(epos, end);
 }
 
-void thread_pool_t::thrproc(std::vector<thr_data_t> &&data, std::mutex *mtx,
-                            std::vector<gff_data_tmp_t> *out, std::string *error,
-                            bool attrval_onlystr)
+void gff_columns_t::build(const std::vector<gff_data_t> &data)
+{
+    clear();
+    auto n = data.size();
+    seqid.resize(n);
+    type.resize(n);
+    source.resize(n);
+    attr_offset.resize(n + 1);
+    std::size_t nattrs = 0;
+    for(const auto &d: data)
+        nattrs += d.attributes.size();
+    attr_name.reserve(nattrs);
+    for(std::size_t i = 0; i < n; ++i) {
+        const auto &d = data[i];
+        seqid[i] = d.position.seqid.id;
+        type[i] = d.type.id;
+        source[i] = d.source.id;
+        attr_offset[i] = static_cast<uint32_t>(attr_name.size());
+        for(const auto &a: d.attributes)
+            attr_name.push_back(a.first.id);
+    }
+    attr_offset[n] = static_cast<uint32_t>(attr_name.size());
+}
+
+void gff_columns_t::clear()
+{
+    seqid.clear();
+    type.clear();
+    source.clear();
+    attr_offset.clear();
+    attr_name.clear();
+}
+
+bool gff_columns_t::has_attr(std::size_t id, gff_symbol_t name) const
+{
+    auto first = attr_name.begin() + attr_offset[id];
+    auto last = attr_name.begin() + attr_offset[id + 1];
+    return std::binary_search(first, last, name.id);
+}
+
+bool gff_columns_t::has_attrs(std::size_t id, const std::vector<gff_symbol_t> &names) const
+{
+    for(auto name: names)
+        if(!has_attr(id, name)) return false;
+    return true;
+}
+
+void gff_interval_index_t::build(gff_data_t *base, std::vector<uint32_t> &&ids)
+{
+    _base = base;
+    _ids = std::move(ids);
+    std::stable_sort(_ids.begin(), _ids.end(), [base](uint32_t a, uint32_t b) {
+        return base[a].position.start < base[b].position.start;
+    });
+    fill_positions();
+    _maxend.resize(_ids.size());
+    _maxlevel = -1;
+    const int64_t n = static_cast<int64_t>(_ids.size());
+    if(!n) return;
+    // leaves (even indexes) keep own end, inner nodes of level k - max of subtree
+    int64_t last_i = 0;
+    uint64_t last = 0;
+    for(int64_t i = 0; i < n; i += 2) {
+        last_i = i;
+        last = _maxend[i] = _end[i];
+    }
+    int k = 1;
+    for(; (int64_t(1) << k) <= n; ++k) {
+        int64_t x = int64_t(1) << (k - 1), i0 = (x << 1) - 1, step = x << 2;
+        for(int64_t i = i0; i < n; i += step) {
+            uint64_t el = _maxend[i - x];
+            uint64_t er = i + x < n ? _maxend[i + x] : last;
+            _maxend[i] = std::max({_end[i], el, er});
+        }
+        last_i = (last_i >> k & 1) ? last_i - x : last_i + x;
+        if(last_i < n && _maxend[last_i] > last)
+            last = _maxend[last_i];
+    }
+    _maxlevel = k - 1;
+}
+
+void gff_interval_index_t::overlap(uint64_t spos, uint64_t epos, std::vector<gff_data_t *> &out) const
+{
+    const std::size_t first = out.size();
+    for_each_overlap(spos, epos, [&](std::size_t i) { out.push_back(_base + _ids[i]); });
+    // keep results in the file order
+    std::sort(out.begin() + first, out.end());
+}
+
+bool gff_interval_index_t::assign(gff_data_t *base, std::vector<uint32_t> &&ids, std::vector<uint64_t> &&maxend, int maxlevel)
+{
+    int level = -1; // floor(log2(n)), as build() gets it
+    while(level < 62 && (uint64_t(1) << (level + 1)) <= ids.size())
+        ++level;
+    if(maxlevel != level || maxend.size() != ids.size())
+        return false;
+    _base = base;
+    _ids = std::move(ids);
+    _maxend = std::move(maxend);
+    _maxlevel = maxlevel;
+    fill_positions();
+    return true;
+}
+
+void gff_interval_index_t::fill_positions()
+{
+    _start.resize(_ids.size());
+    _end.resize(_ids.size());
+    for(std::size_t i = 0; i < _ids.size(); ++i) {
+        const auto &pos = _base[_ids[i]].position;
+        _start[i] = pos.start;
+        _end[i] = pos.end;
+    }
+}
+
+std::size_t gff_interval_index_t::upper_bound(uint64_t pos) const
+{
+    return static_cast<std::size_t>(std::upper_bound(_start.begin(), _start.end(), pos) - _start.begin());
+}
+
+const std::vector<uint32_t> &gff_interval_index_t::ids() const
+{
+    return _ids;
+}
+
+const std::vector<uint64_t> &gff_interval_index_t::maxend() const
+{
+    return _maxend;
+}
+
+int gff_interval_index_t::maxlevel() const
+{
+    return _maxlevel;
+}
+
+std::size_t gff_interval_index_t::size() const
+{
+    return _ids.size();
+}
+
+bool gff_interval_index_t::empty() const
+{
+    return _ids.empty();
+}
+
+void gff_id_index_t::build(const std::vector<uint32_t> &keys)
+{
+    clear();
+    for(auto k: keys) {
+        gff_symbol_t key;
+        key.id = k;
+        ++_groups[key].second; // count
+    }
+    uint32_t offset = 0;
+    for(auto &g: _groups) {
+        auto count = g.second.second;
+        g.second = {offset, offset}; // end is the fill position
+        offset += count;
+    }
+    _ids.resize(keys.size());
+    for(std::size_t id = 0; id < keys.size(); ++id) {
+        gff_symbol_t key;
+        key.id = keys[id];
+        _ids[_groups[key].second++] = static_cast<uint32_t>(id);
+    }
+}
+
+void gff_id_index_t::add(gff_symbol_t key, const std::vector<uint32_t> &ids)
+{
+    auto begin = static_cast<uint32_t>(_ids.size());
+    _ids.insert(_ids.end(), ids.begin(), ids.end());
+    _groups[key] = {begin, static_cast<uint32_t>(_ids.size())};
+}
+
+gff_id_index_t::range_t gff_id_index_t::find(gff_symbol_t key) const
+{
+    auto it = _groups.find(key);
+    if(it == _groups.end()) return {0, 0};
+    return it->second;
+}
+
+void gff_id_index_t::clear()
+{
+    _groups.clear();
+    _ids.clear();
+}
+
+void thread_pool_t::thrproc(thr_chunk_t &&data, std::mutex *mtx,
+                            std::vector<gff_data_tmp_t> *out, std::string *error, std::atomic<bool> *failed,
+                            bool attrval_onlystr, const gff_projection_t *projection,
+                            const gff_load_filter_t *filter)
 {
     gff_data_tmp_t outtmp;
-    for(auto &d: data) {
+    auto parse = [&](std::string_view line, uint64_t lnum) {
         std::string err;
-        auto linedata = gff_parser_t::parse_line(d.data, err, d.lnum, attrval_onlystr);
+        auto linedata = gff_parser_t::parse_line(line, err, lnum, attrval_onlystr, projection, filter);
         if(!err.empty()) {
             std::lock_guard<std::mutex> lk(*mtx);
-            *error = err;
+            if(error->empty()) *error = err;
+            failed->store(true, std::memory_order_release);
         }
         if(!linedata.empty())
             outtmp.data.push_back(std::move(linedata));
+    };
+    if(!data.text.empty()) {
+        outtmp.linestart = data.lnum;
+        outtmp.lineend = for_each_line(data.text, data.lnum, [&](std::string_view line, uint64_t lnum) {
+            if(!line.empty() && line[0] != '#')
+                parse(line, lnum);
+        });
+    }
+    else if(!data.lines.empty()) {
+        outtmp.data.reserve(data.lines.size());
+        for(auto &d: data.lines)
+            parse(d.data, d.lnum);
+        outtmp.linestart = data.lines.front().lnum;
+        outtmp.lineend = data.lines.back().lnum;
     }
     if(!outtmp.data.empty()) {
-        outtmp.linestart = data.front().lnum;
-        outtmp.lineend = data.back().lnum;
         std::lock_guard<std::mutex> lk(*mtx);
         out->push_back(std::move(outtmp));
     }
 }
 
-void thread_pool_t::push(const std::string &line, uint64_t linenum)
+thread_pool_t::~thread_pool_t()
 {
-    constexpr std::size_t max_lines_in_pool = 1000;
+    {
+        std::lock_guard<std::mutex> lk(_queue_mtx);
+        _stop = true;
+    }
+    _queue_cv.notify_all();
+    for(auto &t: _tpool)
+        if(t.joinable()) t.join();
+}
 
+void thread_pool_t::worker()
+{
+    for(;;) {
+        thr_chunk_t chunk;
+        {
+            std::unique_lock<std::mutex> lk(_queue_mtx);
+            _queue_cv.wait(lk, [this]{ return _stop || !_queue.empty(); });
+            if(_queue.empty()) return; // stop
+            chunk = std::move(_queue.front());
+            _queue.pop_front();
+            ++_busy;
+        }
+        _space_cv.notify_one();
+        thrproc(std::move(chunk), &_data_mtx, &_data, &_error, &_failed, _attronlystr, _projection, _filter);
+        {
+            std::lock_guard<std::mutex> lk(_queue_mtx);
+            --_busy;
+            if(!_busy && _queue.empty())
+                _idle_cv.notify_all();
+        }
+    }
+}
+
+void thread_pool_t::wait_idle()
+{
+    std::unique_lock<std::mutex> lk(_queue_mtx);
+    _idle_cv.wait(lk, [this]{ return !_busy && _queue.empty(); });
+}
+
+void thread_pool_t::push(const std::string &line, uint64_t linenum)
+{
     std::lock_guard<std::mutex> lk(_tmpdata_mtx);
-    _tmpdata.push_back({line, linenum});
-    if(_tmpdata.size() > max_lines_in_pool) {
+    if(_tmpdata.lines.empty())
+        _tmpdata.lines.reserve(_chunk_size);
+    _tmpdata.lines.push_back({line, linenum});
+    if(_tmpdata.lines.size() >= _chunk_size) {
         makeproc(std::move(_tmpdata), false);
-        _tmpdata = std::vector<thr_data_t>();
+        _tmpdata = thr_chunk_t();
     }
 }
 
+void thread_pool_t::push_block(std::string_view text, uint64_t linenum)
+{
+    thr_chunk_t chunk;
+    chunk.text = text;
+    chunk.lnum = linenum;
+    makeproc(std::move(chunk), false);
+}
+
+std::size_t thread_pool_t::chunk_size() const
+{
+    return _chunk_size;
+}
+
 void thread_pool_t::flush()
 {
     std::lock_guard<std::mutex> lk(_tmpdata_mtx);
-    if(!_tmpdata.empty()) {
+    if(!_tmpdata.lines.empty()) {
         makeproc(std::move(_tmpdata), true);
-        _tmpdata = std::vector<thr_data_t>();
+        _tmpdata = thr_chunk_t();
     }
-    for(auto &t: _tpool)
-        if(t.joinable()) t.join();
-    _tpool.clear();
+    wait_idle();
+    _chunk_size = min_lines_in_chunk;
 }
 
 bool thread_pool_t::empty()
 {
     std::lock_guard<std::mutex> lk1(_data_mtx);
     std::lock_guard<std::mutex> lk2(_tmpdata_mtx);
-    return _tmpdata.empty() && _data.empty() && _tpool.empty();
+    std::lock_guard<std::mutex> lk3(_queue_mtx);
+    return _tmpdata.lines.empty() && _data.empty() && _queue.empty() && !_busy;
 }
 
 std::vector<gff_data_tmp_t> thread_pool_t::data()
@@ -701,21 +2142,36 @@ std::vector<gff_data_tmp_t> thread_pool_t::data()
     return r;
 }
 
-void thread_pool_t::makeproc(std::vector<thr_data_t> &&data, bool sync)
+std::string thread_pool_t::error()
 {
-    if(sync) {
-        for(auto &t: _tpool)
-            if(t.joinable()) t.join();
-        _tpool.clear();
-        thread_pool_t::thrproc(std::move(data), &_data_mtx, &_data, _error, _attronlystr);
+    std::lock_guard<std::mutex> lk(_data_mtx);
+    return _error;
+}
+
+void thread_pool_t::makeproc(thr_chunk_t &&data, bool sync)
+{
+    if(sync) { // tail of the input, parse it here while the workers finish
+        thread_pool_t::thrproc(std::move(data), &_data_mtx, &_data, &_error, &_failed, _attronlystr, _projection, _filter);
         return;
     }
-    if(_tpool.size() >= _thrmax) {
-        if(_tpool.front().joinable())
-            _tpool.front().join();
-        _tpool.pop_front();
+    std::size_t queued = 0;
+    {
+        std::unique_lock<std::mutex> lk(_queue_mtx);
+        if(_tpool.empty()) {
+            for(int i = 0; i < _thrmax; ++i)
+                _tpool.push_back(std::thread(&thread_pool_t::worker, this));
+        }
+        const std::size_t queue_max = _tpool.size() * queue_per_thread;
+        _space_cv.wait(lk, [&]{ return _queue.size() < queue_max; });
+        _queue.push_back(std::move(data));
+        queued = _queue.size();
     }
-    _tpool.push_back(std::thread(&thread_pool_t::thrproc, std::move(data), &_data_mtx, &_data, _error, _attronlystr));
+    _queue_cv.notify_one();
+    // adaptive chunk size: workers keep up - smaller chunks, fall behind - bigger ones
+    if(queued > _tpool.size())
+        _chunk_size = std::min(_chunk_size * 2, max_lines_in_chunk);
+    else if(queued <= 1)
+        _chunk_size = std::max(_chunk_size / 2, min_lines_in_chunk);
 }
 
 gff_attribute_t &gff_attribute_t::add_value(const std::string &val)
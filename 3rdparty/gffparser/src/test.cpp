@@ -41,7 +41,7 @@ int main(int argc, char **argv) {
               << std::endl;
     std::cout << "RESULT1:" << std::endl;
     for(const auto &g: gene_id)
-        std::cout << g->type << ": " << g->get_attr("gene_name").get_string() << " / " << g->get_attr("gene_id").get_string() << std::endl;
+        std::cout << g->type.str() << ": " << g->get_attr("gene_name").get_string() << " / " << g->get_attr("gene_id").get_string() << std::endl;
         //std::cout << g->str() << std::endl;
 
     std::cout << "select type=gene position=chr20:44619522-44651699" << std::endl;
@@ -52,7 +52,7 @@ int main(int argc, char **argv) {
               << std::endl;
     std::cout << "RESULT2:" << std::endl;
     for(const auto &g: gene_pos)
-        std::cout << g->type << ": " << g->get_attr("gene_name").get_string() << " / " << g->get_attr("gene_id").get_string() << std::endl;
+        std::cout << g->type.str() << ": " << g->get_attr("gene_name").get_string() << " / " << g->get_attr("gene_id").get_string() << std::endl;
         //std::cout << g->str() << std::endl;
 
     return 0;
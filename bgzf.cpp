@@ -0,0 +1,457 @@
+#include "bgzf.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// BGZF block: gzip member with the 'BC' extra subfield (total block size - 1),
+// deflate data, crc32 and size of the inflated data (at most 64KB)
+static constexpr std::size_t bgzf_header_size = 12;
+static constexpr std::size_t bgzf_trailer_size = 8;
+static constexpr std::size_t bgzf_max_block_size = 0x10000; // compressed and inflated size limit
+
+static uint32_t get_le16(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static bool check_gzip_header(const unsigned char *hdr)
+{
+    return hdr[0] == 31 && hdr[1] == 139 && hdr[2] == 8 && (hdr[3] & 4);
+}
+
+static std::size_t read_full(int fd, void *buf, std::size_t size)
+{
+    std::size_t done = 0;
+    while(done < size) {
+        auto r = ::read(fd, static_cast<char*>(buf) + done, size - done);
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) break;
+        done += static_cast<std::size_t>(r);
+    }
+    return done;
+}
+
+void parallel_streambuf_t::start(int threads)
+{
+    if(threads <= 0) return;
+    _max_batches = static_cast<std::size_t>(threads) * batches_per_thread;
+    for(int i = 0; i < threads; ++i)
+        _workers.emplace_back(&parallel_streambuf_t::worker, this);
+}
+
+void parallel_streambuf_t::stop()
+{
+    {
+        std::lock_guard<std::mutex> lk(_mtx);
+        _stop = true;
+    }
+    _space_cv.notify_all();
+    for(auto &t: _workers)
+        t.join();
+    _workers.clear();
+}
+
+const std::string &parallel_streambuf_t::error() const
+{
+    return _error;
+}
+
+void parallel_streambuf_t::worker()
+{
+    for(;;) {
+        batch_t batch;
+        uint64_t seq = 0;
+        {
+            std::unique_lock<std::mutex> lk(_mtx);
+            _space_cv.wait(lk, [this]() { return _stop || _eof || _next_read - _next_out < _max_batches; });
+            if(_stop || _eof) return;
+            if(!read_batch(batch)) {
+                _eof = true;
+                _space_cv.notify_all();
+                _ready_cv.notify_all();
+                return;
+            }
+            seq = _next_read++;
+            if(_eof) _space_cv.notify_all();
+        }
+        decode_batch(batch);
+        {
+            std::lock_guard<std::mutex> lk(_mtx);
+            _ready.emplace(seq, std::move(batch));
+        }
+        _ready_cv.notify_all();
+    }
+}
+
+parallel_streambuf_t::int_type parallel_streambuf_t::underflow()
+{
+    if(gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+    while(_error.empty()) {
+        batch_t batch;
+        if(_workers.empty()) {
+            if(_eof || !read_batch(batch)) {
+                _eof = true;
+                break;
+            }
+            decode_batch(batch);
+        }
+        else {
+            std::unique_lock<std::mutex> lk(_mtx);
+            _ready_cv.wait(lk, [this]() { return _ready.count(_next_out) || (_eof && _next_out == _next_read); });
+            auto it = _ready.find(_next_out);
+            if(it == _ready.end())
+                break;
+            batch = std::move(it->second);
+            _ready.erase(it);
+            ++_next_out;
+            _space_cv.notify_all();
+        }
+        _error = batch.error;
+        _cur = std::move(batch.data);
+        if(!_cur.empty()) {
+            setg(&_cur[0], &_cur[0], &_cur[0] + _cur.size());
+            return traits_type::to_int_type(*gptr());
+        }
+    }
+    return traits_type::eof();
+}
+
+bgzf_streambuf_t::bgzf_streambuf_t(const std::string &path, int threads)
+    : _path(path)
+{
+    _fd = ::open(path.c_str(), O_RDONLY);
+    if(_fd < 0) {
+        _eof = true;
+        return;
+    }
+    start(threads);
+}
+
+bgzf_streambuf_t::~bgzf_streambuf_t()
+{
+    stop();
+    if(_fd >= 0)
+        ::close(_fd);
+}
+
+bool bgzf_streambuf_t::is_open() const
+{
+    return _fd >= 0;
+}
+
+bool bgzf_streambuf_t::is_bgzf(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    unsigned char hdr[18];
+    auto n = read_full(fd, hdr, sizeof(hdr));
+    ::close(fd);
+    return n == sizeof(hdr) && check_gzip_header(hdr) && get_le16(hdr + 10) >= 6 &&
+           hdr[12] == 'B' && hdr[13] == 'C' && get_le16(hdr + 14) == 2;
+}
+
+// appends the next block to raw: block size, 0 - end of file, npos - broken block
+static std::size_t read_block(int fd, std::string &raw)
+{
+    unsigned char hdr[bgzf_header_size];
+    auto n = read_full(fd, hdr, sizeof(hdr));
+    if(n == 0) return 0;
+    auto offset = raw.size();
+    std::size_t bsize = 0;
+    if(n == sizeof(hdr) && check_gzip_header(hdr)) {
+        // extra field, looking for the 'BC' subfield
+        std::string extra(get_le16(hdr + 10), '\0');
+        if(read_full(fd, extra.data(), extra.size()) == extra.size()) {
+            auto p = reinterpret_cast<const unsigned char*>(extra.data());
+            for(std::size_t i = 0; i + 4 <= extra.size(); ) {
+                auto slen = get_le16(p + i + 2);
+                if(p[i] == 'B' && p[i+1] == 'C' && slen == 2 && i + 6 <= extra.size())
+                    bsize = get_le16(p + i + 4) + 1;
+                i += 4 + slen;
+            }
+            if(bsize >= bgzf_header_size + extra.size() + bgzf_trailer_size) {
+                raw.append(reinterpret_cast<const char*>(hdr), sizeof(hdr));
+                raw.append(extra);
+                auto rest = bsize - bgzf_header_size - extra.size();
+                raw.resize(offset + bsize);
+                if(read_full(fd, &raw[offset + bgzf_header_size + extra.size()], rest) != rest)
+                    bsize = 0;
+            }
+            else bsize = 0;
+        }
+    }
+    if(!bsize) {
+        raw.resize(offset);
+        return std::string::npos;
+    }
+    return bsize;
+}
+
+// appends the inflated block (p, size) to data, false - broken block
+static bool inflate_block(z_stream &zs, unsigned char *p, std::size_t size, std::string &data)
+{
+    if(size < bgzf_header_size + bgzf_trailer_size) return false;
+    auto xlen = get_le16(p + 10);
+    if(size < bgzf_header_size + xlen + bgzf_trailer_size) return false;
+    auto crc = get_le32(p + size - 8);
+    auto isize = get_le32(p + size - 4);
+    if(isize > bgzf_max_block_size) return false; // not resized to a broken size
+    if(!isize) return true; // empty (end of file) block
+    auto pos = data.size();
+    data.resize(pos + isize);
+    inflateReset(&zs);
+    zs.next_in = p + bgzf_header_size + xlen;
+    zs.avail_in = static_cast<uInt>(size - bgzf_header_size - xlen - bgzf_trailer_size);
+    zs.next_out = reinterpret_cast<Bytef*>(&data[pos]);
+    zs.avail_out = isize;
+    auto ret = inflate(&zs, Z_FINISH);
+    if(ret != Z_STREAM_END || zs.avail_out != 0 ||
+       crc32(0, reinterpret_cast<const Bytef*>(&data[pos]), isize) != crc) {
+        data.resize(pos);
+        return false;
+    }
+    return true;
+}
+
+bool bgzf_streambuf_t::read_batch(batch_t &batch)
+{
+    while(batch.blocks.size() < batch_blocks) {
+        auto offset = batch.raw.size();
+        auto bsize = read_block(_fd, batch.raw);
+        if(bsize == 0) {
+            _eof = true;
+            break;
+        }
+        if(bsize == std::string::npos) {
+            batch.error = "'" + _path + "' is not a valid BGZF file (block #" +
+                          std::to_string(batch.blocks.size()) + " of the batch is broken)";
+            _eof = true;
+            break;
+        }
+        batch.blocks.push_back(offset);
+    }
+    return !batch.blocks.empty() || !batch.error.empty();
+}
+
+void bgzf_streambuf_t::decode_batch(batch_t &batch) const
+{
+    z_stream zs{};
+    if(inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+        batch.error = "zlib init error";
+        return;
+    }
+    for(std::size_t i = 0; i < batch.blocks.size(); ++i) {
+        auto offset = batch.blocks[i];
+        auto end = i + 1 < batch.blocks.size() ? batch.blocks[i+1] : batch.raw.size();
+        if(!inflate_block(zs, reinterpret_cast<unsigned char*>(&batch.raw[offset]), end - offset, batch.data)) {
+            batch.error = "BGZF block inflate error (corrupted data)";
+            break;
+        }
+    }
+    inflateEnd(&zs);
+    std::string().swap(batch.raw);
+}
+
+bgzf_reader_t::bgzf_reader_t(const std::string &path)
+    : _path(path)
+{
+    _fd = ::open(path.c_str(), O_RDONLY);
+    if(_fd >= 0)
+        inflateInit2(&_zs, -MAX_WBITS);
+}
+
+bgzf_reader_t::~bgzf_reader_t()
+{
+    if(_fd >= 0) {
+        inflateEnd(&_zs);
+        ::close(_fd);
+    }
+}
+
+bool bgzf_reader_t::is_open() const
+{
+    return _fd >= 0;
+}
+
+bool bgzf_reader_t::seek(uint64_t coffset)
+{
+    if(_fd < 0 || ::lseek(_fd, static_cast<off_t>(coffset), SEEK_SET) < 0) {
+        _error = "'" + _path + "' seek error";
+        return false;
+    }
+    _coffset = coffset;
+    return true;
+}
+
+bool bgzf_reader_t::read_block(std::string &data, uint64_t &coffset)
+{
+    data.clear();
+    if(_fd < 0 || !_error.empty()) return false;
+    auto bsize = ::read_block(_fd, _raw);
+    if(bsize == 0) return false;
+    if(bsize == std::string::npos) {
+        _error = "'" + _path + "' is not a valid BGZF file (broken block at " + std::to_string(_coffset) + ")";
+        return false;
+    }
+    coffset = _coffset;
+    _coffset += bsize;
+    bool ok = inflate_block(_zs, reinterpret_cast<unsigned char*>(&_raw[0]), bsize, data);
+    _raw.clear();
+    if(!ok) _error = "BGZF block inflate error (corrupted data)";
+    return ok;
+}
+
+const std::string &bgzf_reader_t::error() const
+{
+    return _error;
+}
+
+// empty block, end of file marker
+static constexpr unsigned char bgzf_eof_block[28] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+    0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static void put_le16(unsigned char *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+}
+
+static void put_le32(unsigned char *p, uint32_t v)
+{
+    put_le16(p, v & 0xffff);
+    put_le16(p + 2, v >> 16);
+}
+
+bgzf_writer_t::bgzf_writer_t(sink_t sink, int threads)
+    : _sink(std::move(sink))
+{
+    if(threads <= 0) return;
+    _max_chunks = static_cast<std::size_t>(threads) * chunks_per_thread;
+    for(int i = 0; i < threads; ++i)
+        _workers.emplace_back(&bgzf_writer_t::worker, this);
+}
+
+bgzf_writer_t::~bgzf_writer_t()
+{
+    finish();
+}
+
+void bgzf_writer_t::deflate_chunk(std::string_view text, std::string &out)
+{
+    z_stream zs{};
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    for(std::size_t pos = 0; pos < text.size(); pos += block_text_size) {
+        auto part = text.substr(pos, block_text_size);
+        auto offset = out.size();
+        out.resize(offset + bgzf_max_block_size);
+        auto p = reinterpret_cast<unsigned char*>(&out[offset]);
+        const auto hsize = bgzf_header_size + 6;
+        auto cdata_max = bgzf_max_block_size - hsize - bgzf_trailer_size;
+        int ret = Z_STREAM_ERROR;
+        for(int level: {Z_DEFAULT_COMPRESSION, 0}) { // incompressible text is stored
+            deflateReset(&zs);
+            deflateParams(&zs, level, Z_DEFAULT_STRATEGY);
+            zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(part.data()));
+            zs.avail_in = static_cast<uInt>(part.size());
+            zs.next_out = p + hsize;
+            zs.avail_out = static_cast<uInt>(cdata_max);
+            ret = deflate(&zs, Z_FINISH);
+            if(ret == Z_STREAM_END) break;
+        }
+        auto csize = cdata_max - zs.avail_out;
+        auto bsize = hsize + csize + bgzf_trailer_size;
+        const unsigned char header[] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0};
+        std::memcpy(p, header, sizeof(header));
+        put_le16(p + 16, static_cast<uint32_t>(bsize - 1));
+        put_le32(p + hsize + csize, static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef*>(part.data()), static_cast<uInt>(part.size()))));
+        put_le32(p + hsize + csize + 4, static_cast<uint32_t>(part.size()));
+        out.resize(offset + bsize);
+    }
+    deflateEnd(&zs);
+}
+
+// passes the done chunks to the sink in order (one thread at a time, without the lock)
+void bgzf_writer_t::write_done(std::unique_lock<std::mutex> &lk)
+{
+    if(_writing) return;
+    _writing = true;
+    for(;;) {
+        auto it = _done.find(_next_out);
+        if(it == _done.end()) break;
+        auto data = std::move(it->second);
+        _done.erase(it);
+        lk.unlock();
+        bool ok = _sink(data);
+        lk.lock();
+        if(!ok) _error = true;
+        ++_next_out;
+        _space_cv.notify_all();
+    }
+    _writing = false;
+}
+
+void bgzf_writer_t::worker()
+{
+    std::unique_lock<std::mutex> lk(_mtx);
+    for(;;) {
+        _queue_cv.wait(lk, [this]() { return _stop || !_queue.empty(); });
+        if(_queue.empty()) return;
+        auto chunk = std::move(_queue.front());
+        _queue.pop_front();
+        lk.unlock();
+        std::string out;
+        deflate_chunk(chunk.text, out);
+        lk.lock();
+        _done.emplace(chunk.seq, std::move(out));
+        write_done(lk);
+    }
+}
+
+void bgzf_writer_t::write(std::string &&text)
+{
+    if(text.empty()) return;
+    if(_workers.empty()) {
+        std::string out;
+        deflate_chunk(text, out);
+        if(!_sink(out)) _error = true;
+        return;
+    }
+    std::unique_lock<std::mutex> lk(_mtx);
+    _space_cv.wait(lk, [this]() { return _next_in - _next_out < _max_chunks; });
+    _queue.push_back(chunk_t{_next_in++, std::move(text)});
+    _queue_cv.notify_one();
+}
+
+bool bgzf_writer_t::finish()
+{
+    if(_finished) return !_error;
+    _finished = true;
+    {
+        std::unique_lock<std::mutex> lk(_mtx);
+        _space_cv.wait(lk, [this]() { return _next_out == _next_in; });
+        _stop = true;
+    }
+    _queue_cv.notify_all();
+    for(auto &t: _workers)
+        t.join();
+    _workers.clear();
+    if(!_sink(std::string_view(reinterpret_cast<const char*>(bgzf_eof_block), sizeof(bgzf_eof_block))))
+        _error = true;
+    return !_error;
+}
+
+bool bgzf_writer_t::good()
+{
+    std::lock_guard<std::mutex> lk(_mtx);
+    return !_error;
+}
@@ -0,0 +1,165 @@
+#ifndef BGZF_H
+#define BGZF_H
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+/**
+ * @brief The parallel_streambuf_t class
+ * ordered parallel decoding input: batches are cut in file order (read_batch),
+ * decoded by worker threads (decode_batch) and handed out in file order
+ * (threads <= 0 - decoding on the reading thread)
+ */
+class parallel_streambuf_t : public std::streambuf
+{
+protected:
+    struct batch_t {
+        std::string raw;                   // compressed data
+        std::vector<std::size_t> blocks;   // block offsets in raw
+        uint64_t index = 0;                // source specific batch position
+        std::string data;                  // decoded text
+        std::string error;
+    };
+    bool _eof = false;                     // no more batches (set by read_batch)
+
+    // cuts the next batch, called in order (under lock); false - nothing left
+    virtual bool read_batch(batch_t &batch) = 0;
+    // decodes batch.raw into batch.data, called concurrently
+    virtual void decode_batch(batch_t &batch) const = 0;
+    void start(int threads); // at the end of the derived constructor
+    void stop();             // at the beginning of the derived destructor
+    int_type underflow() override;
+private:
+    static constexpr std::size_t batches_per_thread = 2;
+    std::mutex _mtx;
+    std::condition_variable _ready_cv; // batch decoded
+    std::condition_variable _space_cv; // batch consumed or stop
+    bool _stop = false;
+    uint64_t _next_read = 0;           // sequence number of the next batch read
+    uint64_t _next_out = 0;            // sequence number of the next batch to hand out
+    std::size_t _max_batches = 1;
+    std::map<uint64_t, batch_t> _ready;
+    std::string _cur;                  // current get area
+    std::string _error;
+    std::vector<std::thread> _workers;
+    void worker();
+public:
+    parallel_streambuf_t() = default;
+    parallel_streambuf_t(const parallel_streambuf_t&) = delete;
+    parallel_streambuf_t& operator=(const parallel_streambuf_t&) = delete;
+    const std::string& error() const; // format error (the stream ends at it)
+};
+
+/**
+ * @brief The bgzf_streambuf_t class
+ * BGZF (bgzip) file input: blocks are read by batches and inflated in parallel
+ */
+class bgzf_streambuf_t : public parallel_streambuf_t
+{
+    static constexpr std::size_t batch_blocks = 16;    // ~1MB of text per batch
+    int _fd = -1;
+    std::string _path;
+protected:
+    bool read_batch(batch_t &batch) override;
+    void decode_batch(batch_t &batch) const override;
+public:
+    bgzf_streambuf_t(const std::string &path, int threads);
+    ~bgzf_streambuf_t();
+    bool is_open() const;
+    /**
+     * @brief is_bgzf the file starts with a BGZF block header (gzip with the 'BC' extra field)
+     */
+    static bool is_bgzf(const std::string &path);
+};
+
+class bgzf_istream_t : public std::istream
+{
+    bgzf_streambuf_t _buf;
+public:
+    bgzf_istream_t(const std::string &path, int threads)
+        : std::istream(nullptr), _buf(path, threads) { rdbuf(&_buf); }
+    bool is_open() const { return _buf.is_open(); }
+    const std::string& error() const { return _buf.error(); }
+};
+
+/**
+ * @brief The bgzf_reader_t class
+ * random access BGZF reading: seek to a block (file offset of a virtual offset), inflate blocks one by one
+ */
+class bgzf_reader_t
+{
+    int _fd = -1;
+    std::string _path;
+    std::string _error;
+    std::string _raw;
+    uint64_t _coffset = 0; // file offset of the next block
+    z_stream _zs{};
+public:
+    explicit bgzf_reader_t(const std::string &path);
+    bgzf_reader_t(const bgzf_reader_t&) = delete;
+    bgzf_reader_t& operator=(const bgzf_reader_t&) = delete;
+    ~bgzf_reader_t();
+    bool is_open() const;
+    bool seek(uint64_t coffset);
+    /**
+     * @brief read_block the next block inflated into data, coffset - its file offset
+     * @return false at the end of file or on error (error() is set)
+     */
+    bool read_block(std::string &data, uint64_t &coffset);
+    const std::string& error() const;
+};
+
+/**
+ * @brief The bgzf_writer_t class
+ * BGZF (bgzip compatible) output: text is cut into full 64KB blocks, blocks are deflated
+ * by worker threads and passed to the sink in order (threads <= 0 - on the calling thread)
+ */
+class bgzf_writer_t
+{
+public:
+    typedef std::function<bool(std::string_view)> sink_t;
+    static constexpr std::size_t block_text_size = 0xff00; // max text per block (as in bgzip)
+private:
+    static constexpr std::size_t chunks_per_thread = 4;
+    struct chunk_t {
+        uint64_t seq;
+        std::string text;
+    };
+    sink_t _sink;
+    std::mutex _mtx;
+    std::condition_variable _queue_cv; // new chunk or stop
+    std::condition_variable _space_cv; // chunk written
+    std::deque<chunk_t> _queue;
+    std::map<uint64_t, std::string> _done; // deflated chunks waiting for their turn
+    uint64_t _next_in = 0;
+    uint64_t _next_out = 0;
+    bool _writing = false;             // some thread passes done chunks to the sink
+    bool _stop = false;
+    bool _error = false;
+    bool _finished = false;
+    std::size_t _max_chunks = 1;
+    std::vector<std::thread> _workers;
+    static void deflate_chunk(std::string_view text, std::string &out);
+    void write_done(std::unique_lock<std::mutex> &lk);
+    void worker();
+public:
+    bgzf_writer_t(sink_t sink, int threads);
+    bgzf_writer_t(const bgzf_writer_t&) = delete;
+    bgzf_writer_t& operator=(const bgzf_writer_t&) = delete;
+    ~bgzf_writer_t();
+    void write(std::string &&text); // waits while too many chunks are in flight
+    bool finish();                  // waits for all chunks, writes the end of file block
+    bool good();
+};
+
+#endif // BGZF_H
@@ -0,0 +1,460 @@
+#include "gzindex.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <zlib.h>
+
+static constexpr std::size_t window_size = 32768;
+static constexpr std::size_t input_chunk = 1 << 16;
+static constexpr char gzindex_magic[8] = {'G', 'F', 'F', '3', 'G', 'Z', 'I', 'X'};
+static constexpr uint32_t gzindex_version = 3;
+
+static bool file_stat(const std::string &path, uint64_t &size, int64_t &mtime)
+{
+    struct stat st;
+    if(::stat(path.c_str(), &st) != 0) return false;
+    size = static_cast<uint64_t>(st.st_size);
+    mtime = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+static std::size_t pread_full(int fd, void *buf, std::size_t size, uint64_t offset)
+{
+    std::size_t done = 0;
+    while(done < size) {
+        auto r = ::pread(fd, static_cast<char*>(buf) + done, size - done, static_cast<off_t>(offset + done));
+        if(r < 0 && errno == EINTR) continue;
+        if(r <= 0) break;
+        done += static_cast<std::size_t>(r);
+    }
+    return done;
+}
+
+/**
+ * seqid blocks of gff text: a new range starts at every data line with another seqid
+ */
+struct range_scanner_t {
+    std::vector<gz_index_t::range_t> &ranges;
+    uint64_t &header_end;
+    bool header = true;      // no data lines yet
+    bool linestart = true;
+    uint64_t linebegin = 0;
+    uint64_t linenum = 0;
+    std::string seqid;       // first field of the current line
+    bool inseqid = false;
+    bool skipline = false;   // comment or the rest of the line after seqid
+    range_scanner_t(std::vector<gz_index_t::range_t> &ranges, uint64_t &header_end)
+        : ranges(ranges), header_end(header_end) {}
+    void scan(const unsigned char *text, std::size_t len, uint64_t offset) {
+        for(std::size_t i = 0; i < len; ++i) {
+            if(linestart) {
+                linebegin = offset + i;
+                ++linenum;
+                linestart = false;
+                skipline = text[i] == '#';
+                inseqid = !skipline;
+                seqid.clear();
+            }
+            if(skipline || !inseqid) {
+                auto nl = static_cast<const unsigned char*>(std::memchr(text + i, '\n', len - i));
+                if(!nl) break;
+                i = nl - text;
+                linestart = true;
+                continue;
+            }
+            if(text[i] == '\n' && seqid.empty()) { // empty line
+                linestart = true;
+                continue;
+            }
+            if(text[i] == '\t' || text[i] == '\n') {
+                inseqid = false;
+                if(header) {
+                    header = false;
+                    header_end = linebegin;
+                }
+                if(ranges.empty() || ranges.back().seqid != seqid) {
+                    if(!ranges.empty()) ranges.back().end = linebegin;
+                    ranges.push_back(gz_index_t::range_t{seqid, linebegin, 0, linenum});
+                }
+                if(text[i] == '\n') linestart = true;
+            }
+            else seqid.push_back(static_cast<char>(text[i]));
+        }
+    }
+    void finish(uint64_t size) {
+        if(header) header_end = size;
+        if(!ranges.empty()) ranges.back().end = size;
+    }
+};
+
+bool gz_index_t::build(const std::string &gzpath, uint64_t span)
+{
+    _points.clear();
+    _ranges.clear();
+    _size = _header_end = 0;
+    if(!file_stat(gzpath, _gzsize, _gzmtime)) {
+        _error = "can't open '" + gzpath + "'";
+        return false;
+    }
+    int fd = ::open(gzpath.c_str(), O_RDONLY);
+    if(fd < 0) {
+        _error = "can't open '" + gzpath + "'";
+        return false;
+    }
+    unsigned char magic[2] = {0, 0};
+    _plain = false;
+    if(pread_full(fd, magic, sizeof(magic), 0) < sizeof(magic) || magic[0] != 0x1f || magic[1] != 0x8b)
+        return build_plain(gzpath, fd);
+    z_stream strm{};
+    if(inflateInit2(&strm, 15 + 32) != Z_OK) { // gzip or zlib header
+        ::close(fd);
+        _error = "zlib init error";
+        return false;
+    }
+    std::vector<unsigned char> input(input_chunk);
+    std::vector<unsigned char> window(window_size);
+    uint64_t totin = 0, totout = 0, last = 0, inpos = 0;
+    range_scanner_t scanner(_ranges, _header_end);
+    int ret = Z_OK;
+    strm.avail_out = 0;
+    for(;;) {
+        if(strm.avail_in == 0) {
+            auto n = pread_full(fd, input.data(), input.size(), inpos);
+            if(n == 0) {
+                ret = Z_BUF_ERROR;
+                break;
+            }
+            inpos += n;
+            strm.avail_in = static_cast<uInt>(n);
+            strm.next_in = input.data();
+        }
+        if(strm.avail_out == 0) {
+            strm.avail_out = window_size;
+            strm.next_out = window.data();
+        }
+        auto before = strm.next_out;
+        totin += strm.avail_in;
+        totout += strm.avail_out;
+        ret = inflate(&strm, Z_BLOCK);
+        totin -= strm.avail_in;
+        totout -= strm.avail_out;
+        if(ret == Z_NEED_DICT || ret == Z_MEM_ERROR || ret == Z_DATA_ERROR)
+            break;
+        scanner.scan(before, strm.next_out - before, totout - (strm.next_out - before));
+        if(ret == Z_STREAM_END)
+            break;
+        // deflate block boundary (not the last block): checkpoint
+        if((strm.data_type & 128) && !(strm.data_type & 64) && (totout == 0 || totout - last >= span)) {
+            point_t p;
+            p.out = totout;
+            p.in = totin;
+            p.bits = strm.data_type & 7;
+            // circular window: the oldest text starts at next_out
+            std::size_t left = strm.avail_out;
+            std::string w;
+            w.reserve(window_size);
+            w.append(reinterpret_cast<const char*>(window.data()) + window_size - left, left);
+            w.append(reinterpret_cast<const char*>(window.data()), window_size - left);
+            auto wlen = std::min<uint64_t>(totout, window_size);
+            p.window = w.substr(window_size - wlen);
+            _points.push_back(std::move(p));
+            last = totout;
+        }
+    }
+    bool more = strm.avail_in > 0 || (ret == Z_STREAM_END && inpos < _gzsize);
+    inflateEnd(&strm);
+    ::close(fd);
+    if(ret != Z_STREAM_END) {
+        _error = "'" + gzpath + "' is not a valid gzip file";
+        return false;
+    }
+    if(more) {
+        _error = "'" + gzpath + "' has several gzip members (bgzip files are inflated in parallel without an index)";
+        return false;
+    }
+    _size = totout;
+    scanner.finish(_size);
+    return true;
+}
+
+bool gz_index_t::build_plain(const std::string &path, int fd)
+{
+    std::vector<unsigned char> input(input_chunk * 16);
+    range_scanner_t scanner(_ranges, _header_end);
+    uint64_t pos = 0;
+    for(;;) {
+        auto n = pread_full(fd, input.data(), input.size(), pos);
+        if(n == 0) break;
+        scanner.scan(input.data(), n, pos);
+        pos += n;
+    }
+    ::close(fd);
+    if(pos != _gzsize) {
+        _error = "can't read '" + path + "'";
+        return false;
+    }
+    _plain = true;
+    _size = pos;
+    scanner.finish(_size);
+    return true;
+}
+
+bool gz_index_t::assign_plain(const std::string &path, std::vector<range_t> &&ranges)
+{
+    _points.clear();
+    _ranges = std::move(ranges);
+    if(!file_stat(path, _gzsize, _gzmtime)) {
+        _ranges.clear();
+        _error = "can't open '" + path + "'";
+        return false;
+    }
+    _plain = true;
+    _size = _gzsize;
+    _header_end = _ranges.empty() ? _size : _ranges.front().begin;
+    return true;
+}
+
+bool gz_index_t::save(const std::string &path)
+{
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    if(!ofs.is_open()) {
+        _error = "can't create '" + path + "'";
+        return false;
+    }
+    auto put = [&](const auto &v) { ofs.write(reinterpret_cast<const char*>(&v), sizeof(v)); };
+    auto put_str = [&](const std::string &s) {
+        put(static_cast<uint32_t>(s.size()));
+        ofs.write(s.data(), s.size());
+    };
+    ofs.write(gzindex_magic, sizeof(gzindex_magic));
+    put(gzindex_version);
+    put(_gzsize);
+    put(_gzmtime);
+    put(static_cast<uint8_t>(_plain));
+    put(_size);
+    put(_header_end);
+    put(static_cast<uint64_t>(_points.size()));
+    for(const auto &p: _points) {
+        put(p.out);
+        put(p.in);
+        put(static_cast<int32_t>(p.bits));
+        put_str(p.window);
+    }
+    put(static_cast<uint64_t>(_ranges.size()));
+    for(const auto &r: _ranges) {
+        put_str(r.seqid);
+        put(r.begin);
+        put(r.end);
+        put(r.linenum);
+    }
+    ofs.flush();
+    if(!ofs) {
+        _error = "can't write '" + path + "'";
+        return false;
+    }
+    return true;
+}
+
+bool gz_index_t::load(const std::string &path, const std::string &gzpath)
+{
+    struct stat st;
+    if(::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    std::ifstream ifs(path, std::ios::binary);
+    if(!ifs.is_open())
+        return false;
+    std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    std::size_t pos = 0;
+    bool ok = true;
+    auto get_raw = [&](void *to, std::size_t size) {
+        if(!ok || data.size() - pos < size) {
+            ok = false;
+            return;
+        }
+        std::memcpy(to, data.data() + pos, size);
+        pos += size;
+    };
+    auto get = [&](auto &v) { get_raw(&v, sizeof(v)); };
+    auto get_str = [&](std::string &s) {
+        uint32_t len = 0;
+        get(len);
+        if(!ok || data.size() - pos < len) {
+            ok = false;
+            return;
+        }
+        s.assign(data, pos, len);
+        pos += len;
+    };
+    char magic[sizeof(gzindex_magic)];
+    uint32_t version = 0;
+    get_raw(magic, sizeof(magic));
+    get(version);
+    if(!ok || std::memcmp(magic, gzindex_magic, sizeof(magic)) != 0 || version != gzindex_version)
+        return false;
+    uint64_t gzsize = 0;
+    int64_t gzmtime = 0;
+    get(gzsize);
+    get(gzmtime);
+    uint64_t cursize = 0;
+    int64_t curmtime = 0;
+    if(!ok || !file_stat(gzpath, cursize, curmtime) || cursize != gzsize || curmtime != gzmtime)
+        return false; // index of another file version
+    _gzsize = gzsize;
+    _gzmtime = gzmtime;
+    uint8_t plain = 0;
+    get(plain);
+    _plain = plain != 0;
+    get(_size);
+    get(_header_end);
+    uint64_t n = 0;
+    get(n);
+    _points.clear();
+    for(uint64_t i = 0; ok && i < n; ++i) {
+        point_t p;
+        int32_t bits = 0;
+        get(p.out);
+        get(p.in);
+        get(bits);
+        get_str(p.window);
+        p.bits = bits;
+        if(bits < 0 || bits > 7) ok = false;
+        _points.push_back(std::move(p));
+    }
+    get(n);
+    _ranges.clear();
+    for(uint64_t i = 0; ok && i < n; ++i) {
+        range_t r;
+        get_str(r.seqid);
+        get(r.begin);
+        get(r.end);
+        get(r.linenum);
+        _ranges.push_back(std::move(r));
+    }
+    if(!ok || pos != data.size() || _points.empty() != _plain) {
+        _points.clear();
+        _ranges.clear();
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> gz_index_t::seqids() const
+{
+    std::vector<std::string> r;
+    std::unordered_set<std::string> seen;
+    for(const auto &range: _ranges) {
+        if(seen.insert(range.seqid).second)
+            r.push_back(range.seqid);
+    }
+    return r;
+}
+
+std::vector<gz_index_t::range_t> gz_index_t::seqid_ranges(const std::string &seqid) const
+{
+    std::vector<range_t> r;
+    for(const auto &range: _ranges) {
+        if(range.seqid == seqid)
+            r.push_back(range);
+    }
+    return r;
+}
+
+gz_index_streambuf_t::gz_index_streambuf_t(const std::string &gzpath, const gz_index_t &index, int threads,
+                                           uint64_t begin, uint64_t end)
+    : _index(index), _begin(begin), _end(std::min(end, index.size()))
+{
+    _fd = ::open(gzpath.c_str(), O_RDONLY);
+    const auto &points = _index.points();
+    // last checkpoint at or before begin
+    auto it = std::upper_bound(points.begin(), points.end(), _begin,
+        [](uint64_t pos, const gz_index_t::point_t &p) { return pos < p.out; });
+    _next_point = it == points.begin() ? 0 : static_cast<std::size_t>(it - points.begin()) - 1;
+    if(_fd < 0 || points.empty() || _begin >= _end) {
+        _eof = true;
+        return;
+    }
+    start(threads);
+}
+
+gz_index_streambuf_t::~gz_index_streambuf_t()
+{
+    stop();
+    if(_fd >= 0)
+        ::close(_fd);
+}
+
+bool gz_index_streambuf_t::is_open() const
+{
+    return _fd >= 0;
+}
+
+bool gz_index_streambuf_t::read_batch(batch_t &batch)
+{
+    const auto &points = _index.points();
+    if(_next_point >= points.size() || points[_next_point].out >= _end) {
+        _eof = true;
+        return false;
+    }
+    batch.index = _next_point++;
+    return true;
+}
+
+void gz_index_streambuf_t::decode_batch(batch_t &batch) const
+{
+    const auto &points = _index.points();
+    const auto &p = points[batch.index];
+    uint64_t segend = batch.index + 1 < points.size() ? points[batch.index + 1].out : _index.size();
+    uint64_t from = std::max(_begin, p.out);
+    uint64_t to = std::min(_end, segend);
+    z_stream strm{};
+    if(inflateInit2(&strm, -15) != Z_OK) {
+        batch.error = "zlib init error";
+        return;
+    }
+    uint64_t inpos = p.in;
+    bool ok = true;
+    if(p.bits) {
+        unsigned char c = 0;
+        ok = pread_full(_fd, &c, 1, p.in - 1) == 1;
+        if(ok) inflatePrime(&strm, p.bits, c >> (8 - p.bits));
+    }
+    if(ok && !p.window.empty())
+        ok = inflateSetDictionary(&strm, reinterpret_cast<const Bytef*>(p.window.data()),
+                                  static_cast<uInt>(p.window.size())) == Z_OK;
+    batch.data.resize(to - p.out);
+    strm.next_out = reinterpret_cast<Bytef*>(&batch.data[0]);
+    strm.avail_out = static_cast<uInt>(batch.data.size());
+    std::vector<unsigned char> input(input_chunk);
+    while(ok && strm.avail_out > 0) {
+        if(strm.avail_in == 0) {
+            auto n = pread_full(_fd, input.data(), input.size(), inpos);
+            if(n == 0) {
+                ok = false;
+                break;
+            }
+            inpos += n;
+            strm.avail_in = static_cast<uInt>(n);
+            strm.next_in = input.data();
+        }
+        auto ret = inflate(&strm, Z_NO_FLUSH);
+        if(ret == Z_STREAM_END) {
+            ok = strm.avail_out == 0;
+            break;
+        }
+        if(ret != Z_OK && ret != Z_BUF_ERROR)
+            ok = false;
+    }
+    inflateEnd(&strm);
+    if(!ok) {
+        batch.data.clear();
+        batch.error = "gzip inflate error at the checkpoint #" + std::to_string(batch.index) +
+                      " (the file does not match its index?)";
+        return;
+    }
+    batch.data.erase(0, from - p.out);
+}
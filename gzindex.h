@@ -0,0 +1,89 @@
+#ifndef GZINDEX_H
+#define GZINDEX_H
+#include "bgzf.h"
+#include <limits>
+#include <utility>
+
+/**
+ * @brief The gz_index_t class
+ * random access checkpoints of a plain (single member) gzip file, zlib examples/zran.c approach:
+ * inflate state (bit offset + last 32KB of text) about every span bytes of text,
+ * plus the text ranges of the seqid blocks of a gff file (only them for an uncompressed file)
+ */
+class gz_index_t
+{
+public:
+    struct point_t {
+        uint64_t out = 0;   // text offset
+        uint64_t in = 0;    // compressed offset of the first full byte
+        int bits = 0;       // bits of the byte before 'in' to prime
+        std::string window; // text before 'out' (up to 32KB)
+    };
+    struct range_t {
+        std::string seqid;
+        uint64_t begin = 0; // text offset of the first line
+        uint64_t end = 0;   // text offset after the last line
+        uint64_t linenum = 0; // line number of the first line
+    };
+    static constexpr uint64_t default_span = 4 << 20;
+
+    bool build(const std::string &gzpath, uint64_t span = default_span); // gzip or uncompressed
+    // index of an uncompressed file from the seqid ranges met by its load (file order, no read pass)
+    bool assign_plain(const std::string &path, std::vector<range_t> &&ranges);
+    bool save(const std::string &path);
+    // false if there is no index or it is made for another version of gzpath
+    bool load(const std::string &path, const std::string &gzpath);
+    const std::vector<point_t>& points() const { return _points; }
+    uint64_t size() const { return _size; }
+    bool plain() const { return _plain; } // uncompressed file, text offset = file offset
+    uint64_t header_end() const { return _header_end; } // text offset of the first data line
+    std::vector<std::string> seqids() const; // file order
+    std::vector<range_t> seqid_ranges(const std::string &seqid) const;
+    const std::string& error() const { return _error; }
+    static std::string default_path(const std::string &gzpath) { return gzpath + ".gzidx"; }
+private:
+    uint64_t _gzsize = 0;
+    int64_t _gzmtime = 0;
+    bool _plain = false;
+    uint64_t _size = 0;
+    uint64_t _header_end = 0;
+    std::vector<point_t> _points;
+    std::vector<range_t> _ranges;
+    std::string _error;
+    bool build_plain(const std::string &path, int fd);
+};
+
+/**
+ * @brief The gz_index_streambuf_t class
+ * text range [begin, end) of an indexed gzip file,
+ * segments between the checkpoints are inflated in parallel
+ */
+class gz_index_streambuf_t : public parallel_streambuf_t
+{
+    int _fd = -1;
+    const gz_index_t &_index;
+    uint64_t _begin;
+    uint64_t _end;
+    std::size_t _next_point = 0;
+protected:
+    bool read_batch(batch_t &batch) override;
+    void decode_batch(batch_t &batch) const override;
+public:
+    gz_index_streambuf_t(const std::string &gzpath, const gz_index_t &index, int threads,
+                         uint64_t begin = 0, uint64_t end = std::numeric_limits<uint64_t>::max());
+    ~gz_index_streambuf_t();
+    bool is_open() const;
+};
+
+class gz_index_istream_t : public std::istream
+{
+    gz_index_streambuf_t _buf;
+public:
+    gz_index_istream_t(const std::string &gzpath, const gz_index_t &index, int threads,
+                       uint64_t begin = 0, uint64_t end = std::numeric_limits<uint64_t>::max())
+        : std::istream(nullptr), _buf(gzpath, index, threads, begin, end) { rdbuf(&_buf); }
+    bool is_open() const { return _buf.is_open(); }
+    const std::string& error() const { return _buf.error(); }
+};
+
+#endif // GZINDEX_H
@@ -1,9 +1,23 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
 #include <gffparser.h>
 #include <getopts.h>
 #include <bxzstr.hpp>
 #include <regex>
+#include "outbuffer.h"
+#include "bgzf.h"
+#include "gzindex.h"
+#include "tabix.h"
+#include "projcache.h"
 
 enum class finput_type_t {
     fi_err = -2, fi_unk = -1, fi_bed = 0, fi_vcf = 1, fi_export
@@ -16,24 +30,39 @@ void usage(const std::string &program) {
     std::cerr << "USAGE: "
               << "\n         gff column types: seqid, source, type, pos, endpos, score, strand, phase, attr\n"
               << "\n         " << program
-              << "\n         -gff [path/to/file.gff3] #input gff3 file"
+              << "\n         -gff [path/to/file.gff3] #input gff3 file (with <file>.gzidx seqid blocks are parsed on the first query, their format errors are reported then)"
               << "\n         -type {bed,vcf,export} #input file type (default: get from extension)"
               << "\n         -skip N #(optional) for bed-file only, skip lines (default 0)"
               << "\n         -header N #for bed-file only, header line num (default -1, no header)"
               << "\n         -threads N #max threads (default 4)"
               << "\n         -in path/to/input.{bed,vcf} #input bed or vcf file (or '-' for stdin, '-type' required)"
-              << "\n         -out path/to/output.{bed,vcf} #output file path or '-' for stdout"
+              << "\n         -out path/to/output.{bed,vcf} #output file path or '-' for stdout ('.gz' - bgzip compressed)"
+              << "\n         -ocompress #(optional) bgzip compressed output for any '-out' path"
               << "\n         -seqid N #sequence id column number (default 1)"
               << "\n         -pos N #position column number (default 2)"
               << "\n         -endpos N #(optional) end position column number (info:<name> for vcf)"
               << "\n         -where <par1>...<parN> #(optional) select from gff parameter (format <coltype>[:<attrname>]:<value>)"
               << "\n         -add <par1>...<parN> #fields to add to output file (format: <coltype>[:<attrname>])"
               << "\n         -ext {intersect,length} #add extended information ('intersect' - intersect percent)"
+              << "\n         -sorted #(optional) input is sorted by seqid and position (one sweep over the whole input, unsorted input is an error)"
+              << "\n         -cache #(optional) render '-add' values of all gff records once after load (many hits per record)"
+              << "\n         -region <reg1>...<regN> #(optional) only records overlapping chr:start-end (bgzip '-in' with .tbi/.csi index)"
+              << "\n         -gzidx #(optional) save the seqid offsets met by the load of an uncompressed '-gff' to <file>.gzidx"
+              << "\n"
+              << "\n         " << program << " build-index"
+              << "\n         -gff [path/to/file.gff3] #input gff3 file"
+              << "\n         -threads N #max threads (default 4)"
+              << "\n         -out path/to/snapshot.gffsnap #parsed and indexed gff snapshot (can be used as '-gff')"
+              << "\n"
+              << "\n         " << program << " build-gzindex"
+              << "\n         -gff [path/to/file.gff3[.gz]] #plain gzip or uncompressed gff3 file, seqid block offsets (and inflate checkpoints) are saved to <file>.gzidx"
               << "\n"
               << std::endl;
     std::cerr << "USAGE EXAMPLE: "
               << "\n         " << program << " -h"
               << "\n         " << program << " -gff gencode.v47.primary_assembly.basic.annotation.gff3 -in test1.bed -out - -seqid 1 -pos 2 -where type:gene attr:gene_name:ADA -add attr:gene_name attr:gene_id type"
+              << "\n         " << program << " build-index -gff gencode.v47.primary_assembly.basic.annotation.gff3.gz -out gencode.v47.gffsnap"
+              << "\n         " << program << " build-gzindex -gff gencode.v47.primary_assembly.basic.annotation.gff3.gz"
               << "\n"
               << std::endl;
 }
@@ -85,6 +114,7 @@ enum class select_column_t {
 struct selectpar_t {
     select_column_t colnum = select_column_t::noval;
     std::string attrname;
+    gffparser::gff_symbol_t attrsym; // interned attrname
     std::string value;
     static select_column_t colnum_by_name(const std::string &msg) {
         if(msg == "seqid") return select_column_t::seqid;
@@ -126,6 +156,7 @@ struct selectpar_t {
             else if(fields.size() == 2) {
                 colnum = colnum_by_name(fields[0]);
                 attrname = fields[1];
+                attrsym = gffparser::gff_symbol_t(attrname);
             }
             if(colnum == select_column_t::noval)
                 return "unknown format for '" + _format + "' (for example: 'type' or 'attr:gene_name')";
@@ -181,14 +212,517 @@ finput_type_t check_extension(const std::string &filepath, bool &gzipped)
     return finput_type_t::fi_err;
 }
 
-std::string intersect_percent(uint64_t s1, uint64_t e1, uint64_t s2, uint64_t e2)
+bool is_plain_gff(const std::filesystem::path &path)
+{
+    // uncompressed gff3 starts with '##gff-version'
+    std::ifstream ifs(path, std::ios::binary);
+    char magic[2] = {0, 0};
+    ifs.read(magic, sizeof(magic));
+    return ifs && magic[0] == '#' && magic[1] == '#';
+}
+
+void append_intersect_percent(out_buffer_t &to, uint64_t s1, uint64_t e1, uint64_t s2, uint64_t e2)
 {
     int64_t ival = std::min(e1, e2) - std::max(s1, s2) + 1;
-    if(ival <= 0) return "0";
+    if(ival <= 0) {
+        to << '0';
+        return;
+    }
     int64_t l1 = e1 - s1 + 1;
     if(l1 == 0) throw std::runtime_error("gel length error (=0)");
     int64_t p = (ival * 1000) / l1;
-    return std::to_string(p/10) + "." + std::to_string(p%10);
+    to.append_int(p/10) << '.';
+    to.append_int(p%10);
+}
+
+// '-add' column renderers, one instance per column type (no column switch per record)
+template<select_column_t C>
+void render_column(out_buffer_t &to, const gffparser::gff_data_t &d, gffparser::gff_symbol_t attr, const gffparser::gff_query_t *q)
+{
+    if constexpr(C == select_column_t::seqid) to << d.position.seqid.str();
+    else if constexpr(C == select_column_t::source) to << d.source.str();
+    else if constexpr(C == select_column_t::type) to << d.type.str();
+    else if constexpr(C == select_column_t::pos) to.append_uint(d.position.start);
+    else if constexpr(C == select_column_t::endpos) to.append_uint(d.position.end);
+    else if constexpr(C == select_column_t::score) to.append_fixed(d.score);
+    else if constexpr(C == select_column_t::strand) to.append_int(d.strand);
+    else if constexpr(C == select_column_t::phase) to.append_int(d.phase);
+    else if constexpr(C == select_column_t::attr) to << d.get_attr(attr).get_string();
+    else if constexpr(C == select_column_t::intersect) append_intersect_percent(to, q ? q->start : 0, q ? q->end : 0, d.position.start, d.position.end);
+    else if constexpr(C == select_column_t::length) to.append_uint(q ? q->end - q->start + 1 : 1);
+}
+
+/**
+ * @brief The add_column_t struct
+ * '-add' column compiled once: renderer of the column type and the attribute name id
+ */
+struct add_column_t {
+    typedef void (*render_t)(out_buffer_t&, const gffparser::gff_data_t&, gffparser::gff_symbol_t, const gffparser::gff_query_t*);
+    render_t render = render_column<select_column_t::noval>;
+    gffparser::gff_symbol_t attr;
+    bool per_query = false; // the value depends on the input line (intersect, length)
+    void operator()(out_buffer_t &to, const gffparser::gff_data_t &d, const gffparser::gff_query_t *q) const {
+        render(to, d, attr, q);
+    }
+};
+
+add_column_t compile_column(const selectpar_t &par)
+{
+    add_column_t r;
+    r.attr = par.attrsym;
+    switch (par.colnum) {
+    case select_column_t::noval: break;
+    case select_column_t::seqid: r.render = render_column<select_column_t::seqid>; break;
+    case select_column_t::source: r.render = render_column<select_column_t::source>; break;
+    case select_column_t::type: r.render = render_column<select_column_t::type>; break;
+    case select_column_t::pos: r.render = render_column<select_column_t::pos>; break;
+    case select_column_t::endpos: r.render = render_column<select_column_t::endpos>; break;
+    case select_column_t::score: r.render = render_column<select_column_t::score>; break;
+    case select_column_t::strand: r.render = render_column<select_column_t::strand>; break;
+    case select_column_t::phase: r.render = render_column<select_column_t::phase>; break;
+    case select_column_t::attr: r.render = render_column<select_column_t::attr>; break;
+    case select_column_t::intersect: r.render = render_column<select_column_t::intersect>; r.per_query = true; break;
+    case select_column_t::length: r.render = render_column<select_column_t::length>; r.per_query = true; break;
+    }
+    return r;
+}
+
+bool load_gff_stream(gffparser::gff_parser_t &gff, std::istream &in)
+{
+    std::string line;
+    while(std::getline(in, line)) {
+        gff << line;
+        if(gff.has_error()) {
+            std::cerr << "[GFF ERROR] " << gff.error() << std::endl;
+            return false;
+        }
+    }
+    gff.flush();
+    if(gff.has_error()) {
+        std::cerr << "[GFF ERROR] " << gff.error() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * seqid blocks of an indexed gff ('build-gzindex' or an earlier load of an uncompressed file)
+ * are parsed on the first query of the seqid, only the header lines are loaded here
+ */
+bool load_gff_lazy(gffparser::gff_parser_t &gff, const std::string &path, std::shared_ptr<gz_index_t> index, int threads)
+{
+    auto read_range = [path, index, threads](uint64_t begin, uint64_t end, std::string &text) {
+        if(index->plain()) {
+            std::ifstream ifs(path, std::ios::binary);
+            auto pos = text.size();
+            text.resize(pos + (end - begin));
+            ifs.seekg(static_cast<std::streamoff>(begin));
+            ifs.read(&text[pos], static_cast<std::streamsize>(end - begin));
+            return static_cast<bool>(ifs);
+        }
+        gz_index_istream_t ifs(path, *index, threads, begin, end);
+        std::vector<char> buf(1 << 20);
+        while(ifs.read(buf.data(), buf.size()) || ifs.gcount())
+            text.append(buf.data(), ifs.gcount());
+        return ifs.error().empty();
+    };
+    std::string header;
+    if(!read_range(0, index->header_end(), header)) {
+        std::cerr << "[GFF ERROR] can't read '" << path << "'" << std::endl;
+        return false;
+    }
+    std::istringstream hss(header);
+    if(!load_gff_stream(gff, hss))
+        return false;
+    gff.set_seqid_loader(index->seqids(), [path, index, read_range](const std::string &seqid,
+                         std::vector<gffparser::gff_text_block_t> &blocks, std::string &error) {
+        for(const auto &r: index->seqid_ranges(seqid)) {
+            blocks.emplace_back();
+            blocks.back().linenum = r.linenum;
+            if(!read_range(r.begin, r.end, blocks.back().text)) {
+                error = "can't read seqid '" + seqid + "' block of '" + path + "'";
+                return false;
+            }
+        }
+        return true;
+    });
+    return true;
+}
+
+// lazy - load seqid blocks on the first query if the gff has an index (position queries only),
+// save_gzidx - write the index of an uncompressed gff without one
+bool load_gff(gffparser::gff_parser_t &gff, const std::filesystem::path &gffpath, int threads, const std::string &program,
+              bool lazy = false, bool save_gzidx = false)
+{
+    auto gzindex = std::make_shared<gz_index_t>();
+    if(gffparser::gff_parser_t::is_snapshot(gffpath.string())) {
+        gff.load_snapshot(gffpath.string());
+        if(gff.has_error()) {
+            std::cerr << "[GFF ERROR] " << gff.error() << std::endl;
+            return false;
+        }
+    }
+    else if(is_plain_gff(gffpath)) {
+        auto idxpath = gz_index_t::default_path(gffpath.string());
+        bool indexed = (lazy || save_gzidx) && gzindex->load(idxpath, gffpath.string());
+        if(lazy && indexed && gzindex->header_end())
+            return load_gff_lazy(gff, gffpath.string(), gzindex, threads);
+        // seqid offsets for the lazy loads of the next runs are met by this load
+        bool record = save_gzidx && !indexed;
+        std::vector<gffparser::gff_seqid_block_t> blocks;
+        gff.load_file(gffpath.string(), record ? &blocks : nullptr);
+        if(gff.has_error()) {
+            std::cerr << "[GFF ERROR] " << gff.error() << std::endl;
+            return false;
+        }
+        gff.flush();
+        if(gff.has_error()) {
+            std::cerr << "[GFF ERROR] " << gff.error() << std::endl;
+            return false;
+        }
+        if(record) {
+            std::vector<gz_index_t::range_t> ranges;
+            ranges.reserve(blocks.size());
+            for(auto &b: blocks)
+                ranges.push_back(gz_index_t::range_t{std::move(b.seqid), b.begin, b.end, b.linenum});
+            if(!gzindex->assign_plain(gffpath.string(), std::move(ranges)) || !gzindex->save(idxpath))
+                std::cerr << "[GFF WARNING] seqid index is not saved ('-gzidx'): "
+                          << gzindex->error() << std::endl;
+        }
+    }
+    else if(bgzf_streambuf_t::is_bgzf(gffpath.string())) { // blocks are inflated in parallel
+        bgzf_istream_t gffifs(gffpath.string(), threads);
+        if(!load_gff_stream(gff, gffifs))
+            return false;
+        if(!gffifs.error().empty()) {
+            std::cerr << "[GFF ERROR] " << gffifs.error() << std::endl;
+            return false;
+        }
+    }
+    else if(gzindex->load(gz_index_t::default_path(gffpath.string()), gffpath.string())) {
+        // plain gzip with checkpoints ('build-gzindex'): segments are inflated in parallel
+        if(lazy && gzindex->header_end())
+            return load_gff_lazy(gff, gffpath.string(), gzindex, threads);
+        gz_index_istream_t gffifs(gffpath.string(), *gzindex, threads);
+        if(!load_gff_stream(gff, gffifs))
+            return false;
+        if(!gffifs.error().empty()) {
+            std::cerr << "[GFF ERROR] " << gffifs.error() << std::endl;
+            return false;
+        }
+    }
+    else {
+        bxz::ifstream gffifs(gffpath);
+        if(!gffifs.is_open()) {
+            usage(program);
+            std::cerr << "can't open '" << gffpath.string() << "'" << std::endl;
+            return false;
+        }
+        return load_gff_stream(gff, gffifs);
+    }
+    return true;
+}
+
+enum class line_mode_t {
+    annotate, // data line
+    copy,     // comment, skipped line
+    header,   // header line, add new columns description
+    unsorted  // data line out of order in '-sorted' mode
+};
+
+struct anno_query_t {
+    std::string seqid;
+    uint64_t pos = 0;
+    uint64_t endpos = 0;
+    bool valid = false;
+};
+
+// position column value, error message instead of std::stol exceptions
+uint64_t get_position(std::string_view val)
+{
+    int64_t r = 0;
+    if(!gffparser::utils::parse_int(val, r))
+        throw std::runtime_error("wrong position value '" + std::string(val) + "'");
+    return static_cast<uint64_t>(r);
+}
+
+std::string_view get_column(std::string_view line, int col)
+{
+    std::size_t start = 0;
+    for(int i = 0; i < col; ++i) {
+        start = line.find('\t', start);
+        if(start == std::string_view::npos) return {};
+        ++start;
+    }
+    return line.substr(start, line.find('\t', start) - start);
+}
+
+// get_column, missing column is an error
+std::string_view require_column(std::string_view line, int col)
+{
+    auto val = get_column(line, col);
+    if(!val.data())
+        throw std::runtime_error("no column " + std::to_string(col + 1));
+    return val;
+}
+
+/**
+ * @brief The sort_check_t struct
+ * '-sorted' input order check: every seqid is one block, positions ascending inside the block
+ */
+struct sort_check_t {
+    std::string seqid;
+    uint64_t pos = 0;
+    std::unordered_set<std::string> done;
+    std::string error; // first order error, set before its line is passed on
+    bool next(std::string_view sid, std::string_view pos_s) {
+        int64_t p = 0;
+        if(!gffparser::utils::parse_int(pos_s, p)) return true; // wrong value is reported by the annotation
+        bool ok = sid != seqid ? !done.count(std::string(sid)) : static_cast<uint64_t>(p) >= pos;
+        if(!ok) {
+            if(error.empty()) {
+                error = "input is not sorted by seqid and position ('-sorted'): " + std::string(sid) + ":" + std::to_string(p) +
+                        " after " + seqid + ":" + std::to_string(pos);
+                if(sid != seqid) error += " (seqid " + std::string(sid) + " is not one block)";
+            }
+            return false;
+        }
+        if(sid != seqid) {
+            done.insert(seqid);
+            seqid = sid;
+        }
+        pos = static_cast<uint64_t>(p);
+        return true;
+    }
+};
+
+struct anno_error_t {
+    std::string what;
+    anno_query_t query;
+    std::string line;
+};
+
+// records found for one line (a range of anno_batch_t::items)
+struct anno_items_t {
+    gffparser::gff_data_t *const *first = nullptr;
+    std::size_t count = 0;
+    std::size_t size() const { return count; }
+    gffparser::gff_data_t* operator[](std::size_t i) const { return first[i]; }
+};
+
+struct anno_batch_t {
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+    std::vector<std::string> lines;
+    std::vector<line_mode_t> modes;
+    out_buffer_t out;
+    std::unique_ptr<anno_error_t> error;
+    bool done = false;
+    std::size_t seq = 0;                         // number of the batch in the input
+    std::vector<gffparser::gff_query_t> queries; // positions of the annotate lines (views into lines)
+    std::vector<std::size_t> line_query;         // query of a line or npos
+    std::vector<std::pair<std::size_t, std::size_t> > ranges; // items of a query: offset, count
+    std::vector<gffparser::gff_data_t*> items;
+    anno_items_t items_of(std::size_t query) const {
+        return {items.data() + ranges[query].first, ranges[query].second};
+    }
+};
+
+anno_query_t make_query(const gffparser::gff_query_t &q)
+{
+    return {std::string(q.seqid), q.start, q.end, q.seqid.data() != nullptr};
+}
+
+using classify_fn_t = std::function<line_mode_t(const std::string&)>;
+// position of an annotate line, false - the line is not looked up
+using parse_fn_t = std::function<bool(const std::string&, gffparser::gff_query_t&)>;
+// fills ranges and items for all queries of the batch
+using lookup_fn_t = std::function<void(anno_batch_t&)>;
+using format_fn_t = std::function<void(const std::string&, line_mode_t, out_buffer_t&, const gffparser::gff_query_t&, const anno_items_t&)>;
+
+/**
+ * positions of the batch lines are parsed first and looked up by one batched query,
+ * then the lines are formatted (output stops at the first failed line)
+ */
+void process_batch(anno_batch_t &batch, const parse_fn_t &parse, const lookup_fn_t &lookup, const format_fn_t &format)
+{
+    std::size_t nlines = batch.lines.size();
+    std::unique_ptr<anno_error_t> error;
+    batch.line_query.assign(nlines, anno_batch_t::npos);
+    for(std::size_t i = 0; i < nlines; ++i) {
+        if(batch.modes[i] != line_mode_t::annotate) continue;
+        gffparser::gff_query_t q;
+        try {
+            if(!parse(batch.lines[i], q)) continue;
+        }
+        catch(const std::exception &e) {
+            error.reset(new anno_error_t{e.what(), make_query(q), batch.lines[i]});
+            nlines = i;
+            break;
+        }
+        batch.line_query[i] = batch.queries.size();
+        batch.queries.push_back(q);
+    }
+    try {
+        lookup(batch);
+    }
+    catch(const std::exception &e) { // gff error, the line is not known
+        auto first = batch.queries.empty() ? gffparser::gff_query_t() : batch.queries.front();
+        batch.error.reset(new anno_error_t{e.what(), make_query(first), ""});
+        return;
+    }
+    for(std::size_t i = 0; i < nlines; ++i) {
+        auto outsize = batch.out.size();
+        auto qi = batch.line_query[i];
+        gffparser::gff_query_t q;
+        anno_items_t items;
+        if(qi != anno_batch_t::npos) {
+            q = batch.queries[qi];
+            items = batch.items_of(qi);
+        }
+        else if(batch.modes[i] == line_mode_t::unsorted) { // position for the error report only
+            try {
+                parse(batch.lines[i], q);
+            }
+            catch(const std::exception&) {}
+        }
+        try {
+            format(batch.lines[i], batch.modes[i], batch.out, q, items);
+        }
+        catch(const std::exception &e) {
+            batch.out.resize(outsize);
+            batch.error.reset(new anno_error_t{e.what(), make_query(q), batch.lines[i]});
+            return;
+        }
+    }
+    batch.error = std::move(error);
+}
+
+// reads up to count lines into batch, stops early once stop is set (checked after every line)
+bool read_batch(std::istream &in, const classify_fn_t &classify, anno_batch_t &batch, std::size_t count,
+                const std::atomic<bool> *stop = nullptr)
+{
+    std::string line;
+    while(batch.lines.size() < count && !(stop && stop->load()) && std::getline(in, line)) {
+        if(stop && stop->load()) break;
+        batch.modes.push_back(classify(line));
+        batch.lines.push_back(std::move(line));
+    }
+    return !batch.lines.empty();
+}
+
+/**
+ * reader thread cuts input into batches (classify is called sequentially in input order),
+ * threads workers format them (format must be thread safe), the calling thread writes
+ * batches in input order. Returns false on format error, output is written up to the failed line.
+ */
+bool annotate_stream(std::istream &in, out_writer_t &out, int threads,
+                     const classify_fn_t &classify, const parse_fn_t &parse, const lookup_fn_t &lookup,
+                     const format_fn_t &format, anno_error_t &error)
+{
+    constexpr std::size_t batch_lines = 4096;
+    if(threads <= 1) {
+        for(std::size_t seq = 0;; ++seq) {
+            anno_batch_t batch;
+            batch.seq = seq;
+            if(!read_batch(in, classify, batch, batch_lines)) break;
+            process_batch(batch, parse, lookup, format);
+            out.write(batch.out.view());
+            if(batch.error) {
+                error = *batch.error;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // shared with the reader, which may outlive the call (left blocked in a read after an error)
+    struct state_t {
+        std::mutex mtx;
+        std::condition_variable work_cv;  // new batch, eof or stop
+        std::condition_variable state_cv; // batch done, slot free or reader done
+        std::deque<std::shared_ptr<anno_batch_t> > inflight; // input order
+        std::deque<anno_batch_t*> todo;
+        bool eof = false, stop = false, reader_done = false;
+        std::atomic<bool> stop_reading{false};
+    };
+    auto st = std::make_shared<state_t>();
+    const std::size_t max_inflight = static_cast<std::size_t>(threads) * 2;
+
+    std::thread reader([st, &in, classify, max_inflight]() {
+        for(std::size_t seq = 0;; ++seq) {
+            auto batch = std::make_shared<anno_batch_t>();
+            batch->seq = seq;
+            bool has = read_batch(in, classify, *batch, batch_lines, &st->stop_reading);
+            std::unique_lock<std::mutex> lk(st->mtx);
+            st->state_cv.wait(lk, [&]{ return st->stop || st->inflight.size() < max_inflight; });
+            if(st->stop) break;
+            if(!has) {
+                st->eof = true;
+                st->work_cv.notify_all();
+                break;
+            }
+            st->inflight.push_back(batch);
+            st->todo.push_back(batch.get());
+            st->work_cv.notify_one();
+        }
+        std::lock_guard<std::mutex> lk(st->mtx);
+        st->reader_done = true;
+        st->state_cv.notify_all();
+    });
+    std::vector<std::thread> workers;
+    for(int i = 0; i < threads; ++i) {
+        workers.push_back(std::thread([&]() {
+            for(;;) {
+                std::unique_lock<std::mutex> lk(st->mtx);
+                st->work_cv.wait(lk, [&]{ return st->stop || st->eof || !st->todo.empty(); });
+                if(st->stop || st->todo.empty()) return;
+                auto batch = st->todo.front();
+                st->todo.pop_front();
+                lk.unlock();
+                process_batch(*batch, parse, lookup, format);
+                lk.lock();
+                batch->done = true;
+                st->state_cv.notify_all();
+            }
+        }));
+    }
+
+    bool ok = true;
+    for(;;) {
+        std::unique_lock<std::mutex> lk(st->mtx);
+        st->state_cv.wait(lk, [&]{ return (!st->inflight.empty() && st->inflight.front()->done) ||
+                                          (st->eof && st->inflight.empty()); });
+        if(st->inflight.empty()) break;
+        auto batch = st->inflight.front();
+        st->inflight.pop_front();
+        st->state_cv.notify_all();
+        lk.unlock();
+        out.write(batch->out.view());
+        if(batch->error) {
+            error = *batch->error;
+            ok = false;
+            break;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lk(st->mtx);
+        st->stop = true;
+        st->stop_reading = true;
+    }
+    st->work_cv.notify_all();
+    st->state_cv.notify_all();
+    for(auto &w: workers)
+        w.join();
+    // after an error the reader stops at the next line; one blocked in a read of a stalled
+    // pipe or terminal is not waited for (it holds only the shared state and the input stream)
+    bool reader_done = true;
+    if(!ok) {
+        std::unique_lock<std::mutex> lk(st->mtx);
+        reader_done = st->state_cv.wait_for(lk, std::chrono::milliseconds(200), [&]{ return st->reader_done; });
+    }
+    if(reader_done) reader.join();
+    else reader.detach();
+    return ok;
 }
 
 int main(int argc, char **argv)
@@ -196,9 +730,12 @@ int main(int argc, char **argv)
     get_opts_t inopts(argc, argv);
     std::filesystem::path gffpath;
     bxz::ifstream ifile;
-    std::ofstream ofile;
+    std::unique_ptr<bgzf_istream_t> bgzf_ifile;
+    tabix_index_t tbindex;
+    std::vector<tabix_region_t> regions;
+    std::unique_ptr<tabix_region_istream_t> region_ifile;
     std::istream *iptr = nullptr;
-    std::ostream *optr = nullptr;
+    out_writer_t owriter;
     int seqid = 1;
     int pos = 2;
     int endpos = -1;
@@ -210,11 +747,26 @@ int main(int argc, char **argv)
     finput_type_t ftype = finput_type_t::fi_unk;
     std::vector<selectpar_t> where, add;
     std::string ifpath, ofpath;
+    bool build_index = false;
+    bool build_gzindex = false;
+    bool sorted = false;
+    bool ocompress = false;
+    bool addcache = false;
+    bool save_gzidx = false;
     for(auto &p: inopts.result()) {
         if(p.equal("h")) {
             usage(inopts.program_name());
             return 0;
         }
+        if(p.equal("")) { // mode before the first parameter
+            if(p.values.size() == 1 && p.values.front() == "build-index")
+                build_index = true;
+            else if(p.values.size() == 1 && p.values.front() == "build-gzindex")
+                build_gzindex = true;
+            else
+                return arg_error(join_strlist(p.values, ' '), inopts.program_name(), "unknown mode");
+            continue;
+        }
         if(p.equal("gff")) {
             if(p.values.size() == 1)
                 gffpath = p.values.front();
@@ -223,24 +775,12 @@ int main(int argc, char **argv)
         if(p.equal("in")) {
             if(p.values.size() == 1) {
                 ifpath = p.values.front();
-                if(ifpath == "-")
-                    iptr = &std::cin;
-                else if(ifpath != ofpath)
-                    ifile.open(ifpath);
-                if(!iptr && ifile.is_open())
-                    iptr = &ifile;
             }
             continue;
         }
         if(p.equal("out")) {
             if(p.values.size() == 1) {
                 ofpath = p.values.front();
-                if(ofpath == "-")
-                    optr = &std::cout;
-                else if(ifpath != ofpath)
-                    ofile.open(ofpath);
-                if(!optr && ofile.is_open())
-                    optr = &ofile;
             }
             continue;
         }
@@ -274,6 +814,31 @@ int main(int argc, char **argv)
                 add.push_back(selectpar_t(v, true));
             continue;
         }
+        if(p.equal("sorted")) {
+            sorted = true;
+            continue;
+        }
+        if(p.equal("region")) {
+            for(const auto &v: p.values) {
+                tabix_region_t r;
+                if(!tabix_region_t::parse(v, r))
+                    return arg_type_error("-region", "wrong region '" + v + "' (format: chr:start-end)", inopts.program_name());
+                regions.push_back(r);
+            }
+            continue;
+        }
+        if(p.equal("ocompress")) {
+            ocompress = true;
+            continue;
+        }
+        if(p.equal("cache")) {
+            addcache = true;
+            continue;
+        }
+        if(p.equal("gzidx")) {
+            save_gzidx = true;
+            continue;
+        }
         if(p.equal("skip")) {
             skip = get_colnum(p.values);
             continue;
@@ -307,19 +872,66 @@ int main(int argc, char **argv)
             continue;
         }
     }
+    if(!regions.empty() && (ifpath.empty() || ifpath == "-" || !bgzf_streambuf_t::is_bgzf(ifpath) ||
+                            tabix_index_t::find(ifpath).empty()))
+        return arg_error("-region", inopts.program_name(), "requires a bgzip compressed '-in' file with a tabix index (.tbi/.csi)");
+    if(ifpath == "-")
+        iptr = &std::cin;
+    else if(!ifpath.empty() && ifpath != ofpath) {
+        if(!regions.empty()) { // indexed: only the blocks of the regions are read
+            if(!tbindex.load(tabix_index_t::find(ifpath)))
+                return arg_type_error("-region", tbindex.error(), inopts.program_name());
+            region_ifile.reset(new tabix_region_istream_t(ifpath, tbindex, regions));
+        }
+        else if(bgzf_streambuf_t::is_bgzf(ifpath)) // bgzip: blocks are inflated in parallel
+            bgzf_ifile.reset(new bgzf_istream_t(ifpath, nproc));
+        else
+            ifile.open(ifpath);
+        if(region_ifile && region_ifile->is_open())
+            iptr = region_ifile.get();
+        else if(bgzf_ifile && bgzf_ifile->is_open())
+            iptr = bgzf_ifile.get();
+        else if(ifile.is_open())
+            iptr = &ifile;
+    }
     if(ftype == finput_type_t::fi_unk)
         ftype = check_extension(ifpath, gzipped);
     else check_extension(ifpath, gzipped);
 
     if(gffpath.empty() || !std::filesystem::exists(gffpath))
         return arg_error("-gff", inopts.program_name());
+    if(build_gzindex) {
+        gz_index_t gzindex;
+        if(!gzindex.build(gffpath.string()) || !gzindex.save(gz_index_t::default_path(gffpath.string()))) {
+            std::cerr << "[GFF ERROR] " << gzindex.error() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if(build_index && (ofpath.empty() || ofpath == "-"))
+        return arg_error("-out", inopts.program_name(), "must be a snapshot file path");
+    if(build_index) {
+        gffparser::gff_parser_t gff(nproc, true);
+        if(!load_gff(gff, gffpath, nproc, inopts.program_name()))
+            return 1;
+        gff.save_snapshot(ofpath);
+        if(gff.has_error()) {
+            std::cerr << "[GFF ERROR] " << gff.error() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
     if(ofpath == ifpath)
         return arg_error("-in/-out same", inopts.program_name());
     if(ftype != finput_type_t::fi_export && !iptr)
         return arg_error("-in", inopts.program_name());
     if(ftype == finput_type_t::fi_export && iptr)
         return arg_error("-in,-export", inopts.program_name(), "incompatible parameters");
-    if(!optr)
+    if(!ofpath.empty()) {
+        bool gz = ofpath.size() > 3 && ofpath.compare(ofpath.size() - 3, 3, ".gz") == 0;
+        owriter.open(ofpath, ocompress || gz, nproc);
+    }
+    if(!owriter.is_open())
         return arg_error("-out", inopts.program_name());
     if(nproc < 0)
         return arg_error("-threads", inopts.program_name());
@@ -341,32 +953,6 @@ int main(int argc, char **argv)
             return arg_type_error("-add", er, inopts.program_name());
     }
 
-    gffparser::gff_parser_t gff(nproc, true);
-    {
-        bxz::ifstream gffifs(gffpath);
-        if(!gffifs.is_open()) {
-            usage(inopts.program_name());
-            std::cerr << "can't open '" << gffpath.string() << "'" << std::endl;
-            return 1;
-        }
-        std::string line;
-        while(std::getline(gffifs, line)) {
-            gff << line;
-            if(gff.has_error()) {
-                std::cerr << "[GFF ERROR] " << gff.error() << std::endl;
-                return 1;
-            }
-        }
-        gff.flush();
-        if(gff.has_error()) {
-            std::cerr << "[GFF ERROR] " << gff.error() << std::endl;
-            return 1;
-        }
-    }
-    std::string inln;
-    if(endpos < 0) // single pos mod
-        endpos = pos;
-    seqid -= 1; pos -= 1; endpos -= 1;
     std::vector<gffparser::gff_attribute_t> attr_v;
     std::string type_s;
     bool hasval = false;
@@ -403,184 +989,274 @@ int main(int argc, char **argv)
         }
     }
 
-    std::string *seqid_s = nullptr;
-    uint64_t pos_ui = 0;
-    uint64_t endpos_ui = 0;
-
-    auto getansw = [&]() -> std::vector< std::vector<std::string> > {
-        auto items = seqid_s ?
-                        gff.get_by(type_s, attr_v, gffparser::gff_postition_t(*seqid_s, pos_ui, endpos_ui)) :
-                        gff.get_by(type_s, attr_v);
-        std::vector< std::vector<std::string> > addfields;
-        addfields.resize(add.size());
-        for(const auto &i: items) {
-            for(std::size_t ai = 0; ai < add.size(); ++ai) {
-                auto &a = add[ai];
-                auto &to = addfields[ai];
-                switch (a.colnum) {
-                case select_column_t::noval: break;
-                case select_column_t::seqid: to.push_back(i->position.seqid); break;
-                case select_column_t::source: to.push_back(i->source); break;
-                case select_column_t::type: to.push_back(i->type); break;
-                case select_column_t::pos: to.push_back(std::to_string(i->position.start)); break;
-                case select_column_t::endpos: to.push_back(std::to_string(i->position.end)); break;
-                case select_column_t::score: to.push_back(std::to_string(i->score)); break;
-                case select_column_t::strand: to.push_back(std::to_string(i->strand)); break;
-                case select_column_t::phase: to.push_back(std::to_string(i->phase)); break;
-                case select_column_t::attr: to.push_back(i->get_attr(a.attrname).get_string()); break;
-                case select_column_t::intersect: to.push_back(intersect_percent(pos_ui, endpos_ui, i->position.start, i->position.end)); break;
-                case select_column_t::length: to.push_back(std::to_string(endpos_ui-pos_ui+1)); break;
-                }
+    gffparser::gff_parser_t gff(nproc, true);
+    // only the attributes used by -where/-add are stored
+    std::vector<std::string> used_attrs;
+    for(const auto *pars: {&where, &add}) {
+        for(const auto &p: *pars) {
+            if(p.colnum == select_column_t::attr)
+                used_attrs.push_back(p.attrname);
+        }
+    }
+    gff.set_attr_projection(used_attrs);
+    // records not matching -where are not loaded at all
+    gff.set_load_filter(type_s, "", attr_v);
+    // the cache needs all records, no lazy seqid loading
+    if(!load_gff(gff, gffpath, nproc, inopts.program_name(), ftype != finput_type_t::fi_export && !addcache, save_gzidx))
+        return 1;
+    if(endpos < 0) // single pos mod
+        endpos = pos;
+    seqid -= 1; pos -= 1; endpos -= 1;
+
+    if(ftype == finput_type_t::fi_export) { // attribute lookups without position
+        for(const auto &a: attr_v)
+            gff.index_attr(a.name);
+    }
+
+    // all positions of a batch by one sorted sweep of the gff indexes
+    const gffparser::gff_filter_t filter(type_s, attr_v);
+    auto add_found = [&](anno_batch_t &batch, std::size_t i, const std::vector<gffparser::gff_data_t*> &found) {
+        auto first = batch.items.size();
+        if(batch.queries[i].seqid.empty()) { // no position, as gff_parser_t::get_by
+            auto all = gff.get_by(type_s, attr_v);
+            batch.items.insert(batch.items.end(), all.begin(), all.end());
+        }
+        else {
+            batch.items.insert(batch.items.end(), found.begin(), found.end());
+        }
+        batch.ranges[i] = {first, batch.items.size() - first};
+    };
+    // '-sorted': one sweep for the whole stream, batches take it in input order
+    // and go on from where the previous batch stopped (no sort, no re-seed per batch)
+    gffparser::gff_sweep_t stream_sweep(gff);
+    std::mutex sweep_mtx;
+    std::condition_variable sweep_cv;
+    std::size_t sweep_turn = 0;
+    auto lookup = [&](anno_batch_t &batch) {
+        batch.items.clear();
+        batch.ranges.assign(batch.queries.size(), {0, 0});
+        if(!sorted) {
+            gff.get_by_batch(batch.queries, filter, [&](std::size_t i, const std::vector<gffparser::gff_data_t*> &found) {
+                add_found(batch, i, found);
+            });
+            return;
+        }
+        std::unique_lock<std::mutex> lk(sweep_mtx);
+        sweep_cv.wait(lk, [&]{ return sweep_turn == batch.seq; });
+        auto next_turn = [&]() {
+            ++sweep_turn;
+            sweep_cv.notify_all();
+        };
+        try {
+            std::vector<gffparser::gff_data_t*> found;
+            for(std::size_t i = 0; i < batch.queries.size(); ++i) {
+                const auto &q = batch.queries[i];
+                stream_sweep.overlap(q.seqid, q.start, q.end, filter, found);
+                add_found(batch, i, found);
             }
         }
-        return addfields;
+        catch(...) {
+            next_turn();
+            throw;
+        }
+        next_turn();
+    };
+    std::vector<add_column_t> add_columns;
+    for(const auto &a: add)
+        add_columns.push_back(compile_column(a));
+    // '-cache': values not depending on the query are rendered once per record
+    projection_cache_t cache;
+    std::vector<bool> cached(add.size(), false);
+    if(addcache && ftype != finput_type_t::fi_export) {
+        for(std::size_t c = 0; c < add.size(); ++c)
+            cached[c] = !add_columns[c].per_query;
+        bool ok = cache.build(gff.data(), add.size(), [&](out_buffer_t &to, const gffparser::gff_data_t &d, std::size_t c) {
+            if(cached[c]) add_columns[c](to, d, nullptr);
+        });
+        if(!ok) // too large, values are rendered per hit
+            cached.assign(add.size(), false);
+    }
+    // values of '-add' column c for all items, comma separated
+    auto append_column = [&](out_buffer_t &to, const anno_items_t &items, std::size_t c, const gffparser::gff_query_t *q) {
+        const auto &column = add_columns[c];
+        std::string_view val;
+        for(std::size_t k = 0; k < items.size(); ++k) {
+            if(k) to << ',';
+            if(cached[c] && cache.find(items[k], c, val))
+                to << val;
+            else
+                column(to, *items[k], q);
+        }
     };
 
-    try {
-        std::size_t lncnt = 0;
-        if(ftype == finput_type_t::fi_bed) {
-            while(std::getline(*iptr, inln)) {
-                ++lncnt;
-                std::ostringstream ost;
-                ost << inln;
-                if(header > 0 && lncnt == header) {
-                    header = 0;
-                    for(const auto &a: add)
-                        ost << "\t" << a.orig();
-                    ost << "\n";
-                }
-                else if(skip > 0) {
-                    --skip;
-                    ost << "\n";
-                }
-                else if(inln.empty() || inln[0] == '#') {
-                    ost << "\n";
-                }
-                else {
-                    auto bedfields = gffparser::utils::get_fields(inln, '\t', false);
-                    seqid_s = &bedfields.at(seqid);
-                    pos_ui = std::stol(bedfields.at(pos));
-                    endpos_ui = pos != endpos ? std::stol(bedfields.at(endpos)) : pos;
-                    for(const auto &af: getansw()) {
-                        ost << "\t" << join_strlist(af);
-                    }
-                    ost << "\n";
-                }
-                std::string ost_s = ost.str();
-                optr->write(ost_s.c_str(), ost_s.size());
+    // bed: line classification runs on the reader thread (line counters), formatting on the workers
+    std::size_t lncnt = 0;
+    sort_check_t sort_check;
+    auto classify_bed = [&](const std::string &inln) {
+        ++lncnt;
+        if(header > 0 && lncnt == static_cast<std::size_t>(header)) {
+            header = 0;
+            return line_mode_t::header;
+        }
+        if(skip > 0) {
+            --skip;
+            return line_mode_t::copy;
+        }
+        if(inln.empty() || inln[0] == '#')
+            return line_mode_t::copy;
+        if(sorted && !sort_check.next(get_column(inln, seqid), get_column(inln, pos)))
+            return line_mode_t::unsorted;
+        return line_mode_t::annotate;
+    };
+    auto parse_bed = [&](const std::string &inln, gffparser::gff_query_t &q) {
+        q.seqid = require_column(inln, seqid);
+        q.start = get_position(require_column(inln, pos));
+        q.end = pos != endpos ? get_position(require_column(inln, endpos)) : pos;
+        return true;
+    };
+    auto format_bed = [&](const std::string &inln, line_mode_t mode, out_buffer_t &out,
+                          const gffparser::gff_query_t &q, const anno_items_t &items) {
+        if(mode == line_mode_t::unsorted)
+            throw std::runtime_error(sort_check.error);
+        out << inln;
+        if(mode == line_mode_t::header) {
+            for(const auto &a: add)
+                out << '\t' << a.orig();
+        }
+        else if(mode == line_mode_t::annotate) {
+            for(std::size_t c = 0; c < add.size(); ++c) {
+                out << '\t';
+                append_column(out, items, c, &q);
             }
         }
-        else if(ftype == finput_type_t::fi_vcf) {
-            bool need_info = true;
-            while(std::getline(*iptr, inln)) {
-                ++lncnt;
-                std::ostringstream ost;
-                if(inln.empty() || inln[0] == '#') {
-                    ost << inln << "\n";
-                    if(need_info && inln.size() > 7 && inln.substr(0, 7) == "##INFO=") {
-                        need_info = false;
-                        for(const auto &a: add)
-                            ost << "##INFO=<ID=" << a.attrname
-                                << ",Number=1,Type=String,Description=\""
-                                << inopts.program_name() << " " << a.attrname << "\">\n";
+        out << '\n';
+    };
+
+    bool need_info = true;
+    auto classify_vcf = [&](const std::string &inln) {
+        if(inln.empty() || inln[0] == '#') {
+            if(need_info && inln.size() > 7 && inln.substr(0, 7) == "##INFO=") {
+                need_info = false;
+                return line_mode_t::header;
+            }
+            return line_mode_t::copy;
+        }
+        if(sorted && !sort_check.next(get_column(inln, 0), get_column(inln, 1)))
+            return line_mode_t::unsorted;
+        return line_mode_t::annotate;
+    };
+    // #CHROM-0  POS-1 ID-2  REF-3 ALT-4 QUAL-5    FILTER-6  INFO-7    FORMAT-8  sample-name-9
+    auto parse_vcf = [&](const std::string &inln, gffparser::gff_query_t &q) {
+        std::string_view line(inln);
+        auto tabi1 = line.find('\t');
+        std::size_t tabi0 = 0;
+        for(uint32_t intpos = 0; tabi1 != std::string::npos; ++intpos) {
+            if(intpos == 0) { // chrom
+                q.seqid = line.substr(0, tabi1);
+            }
+            else if(intpos == 1) {
+                q.start = get_position(line.substr(tabi0 + 1, tabi1 - tabi0 - 1));
+            }
+            else if(intpos == 7) { // info
+                q.end = q.start;
+                if(!endpos_vcf.empty()) {
+                    auto ei = line.find(endpos_vcf, tabi0 + 1); // name=<val>;
+                    if(ei != std::string::npos) {
+                        ei += endpos_vcf.size() + 1; // sizeof(name=)
+                        q.end = get_position(line.substr(ei, line.find_first_of(";\t", ei + 1) - ei));
                     }
                 }
-                else {
-                    auto tabi1 = inln.find('\t');
-                    auto tabi0 = 0;
-                    // #CHROM-0  POS-1 ID-2  REF-3 ALT-4 QUAL-5    FILTER-6  INFO-7    FORMAT-8  sample-name-9
-                    uint32_t intpos = 0;
-                    std::string seqid_stmp;
-                    seqid_s = &seqid_stmp;
-                    pos_ui = 0;
-                    endpos_ui = 0;
-                    while(tabi1 != std::string::npos) {
-                        if(intpos == 0) { // chrom
-                            seqid_stmp = inln.substr(0, tabi1);
-                        }
-                        else if(intpos == 1) {
-                            std::string pos_s = inln.substr(tabi0 + 1, tabi1 - tabi0 - 1);
-                            pos_ui = std::stol(pos_s);
-                        }
-                        else if(intpos == 7) { // info
-                            if(endpos_vcf.empty()) {
-                                endpos_ui = pos_ui;
-                            }
-                            else {
-                                auto ei = inln.find(endpos_vcf, tabi0 + 1); // name=<val>;
-                                if(ei != std::string::npos) {
-                                    ei += endpos_vcf.size() + 1; // sizeof(name=)
-                                    auto endpos_s = inln.substr(ei, inln.find_first_of(";\t", ei + 1) - ei);
-                                    endpos_ui = std::stol(endpos_s);
-                                }
-                                else {
-                                    endpos_ui = pos_ui;
-                                }
-                            }
-                            if(tabi1 > 2 && inln[tabi1-1] == '.' && inln[tabi1-2] == '\t') { // INFO = .
-                                ost << inln.substr(0, tabi1-1);
-                                auto af = getansw();
-                                for(std::size_t i = 0; i < add.size(); ++i) {
-                                    if(i) ost << ";";
-                                    ost << add[i].attrname << "=" << join_strlist(af[i]);
-                                }
-                                ost << inln.substr(tabi1);
-                            }
-                            else {
-                                ost << inln.substr(0, tabi1) << ";";
-                                auto af = getansw();
-                                for(std::size_t i = 0; i < add.size(); ++i) {
-                                    if(i) ost << ";";
-                                    ost << add[i].attrname << "=" << join_strlist(af[i]);
-                                }
-                                ost << inln.substr(tabi1);
-                            }
-                        }
-                        tabi0 = tabi1;
-                        tabi1 = inln.find('\t', tabi1+1);
-                        ++intpos;
-                    }
-                    ost << "\n";
+                return true;
+            }
+            tabi0 = tabi1;
+            tabi1 = line.find('\t', tabi1+1);
+        }
+        return false;
+    };
+    auto format_vcf = [&](const std::string &inln, line_mode_t mode, out_buffer_t &out,
+                          const gffparser::gff_query_t &q, const anno_items_t &items) {
+        if(mode == line_mode_t::unsorted)
+            throw std::runtime_error(sort_check.error);
+        if(mode != line_mode_t::annotate) {
+            out << inln << '\n';
+            if(mode == line_mode_t::header) {
+                for(const auto &a: add)
+                    out << "##INFO=<ID=" << a.attrname
+                        << ",Number=1,Type=String,Description=\""
+                        << inopts.program_name() << " " << a.attrname << "\">\n";
+            }
+            return;
+        }
+        std::string_view line(inln);
+        auto tabi1 = line.find('\t');
+        uint32_t intpos = 0;
+        while(tabi1 != std::string::npos) {
+            if(intpos == 7) { // info
+                if(tabi1 > 2 && line[tabi1-1] == '.' && line[tabi1-2] == '\t') // INFO = .
+                    out << line.substr(0, tabi1-1);
+                else
+                    out << line.substr(0, tabi1) << ';';
+                for(std::size_t i = 0; i < add.size(); ++i) {
+                    if(i) out << ';';
+                    out << add[i].attrname << '=';
+                    append_column(out, items, i, &q);
                 }
-                std::string ost_s = ost.str();
-                optr->write(ost_s.c_str(), ost_s.size());
+                out << line.substr(tabi1);
             }
+            tabi1 = line.find('\t', tabi1+1);
+            ++intpos;
+        }
+        out << '\n';
+    };
+
+    anno_error_t anno_err;
+    bool anno_ok = true;
+    try {
+        if(ftype == finput_type_t::fi_bed) {
+            anno_ok = annotate_stream(*iptr, owriter, nproc, classify_bed, parse_bed, lookup, format_bed, anno_err);
+        }
+        else if(ftype == finput_type_t::fi_vcf) {
+            anno_ok = annotate_stream(*iptr, owriter, nproc, classify_vcf, parse_vcf, lookup, format_vcf, anno_err);
         }
         else if(ftype == finput_type_t::fi_export) {
-            std::ostringstream ost;
+            out_buffer_t out;
             for(std::size_t i = 0; i < add.size(); ++i) {
-                if(i) ost << "\t";
-                else ost << "#";
-                ost << add[i].orig();
+                out << (i ? '\t' : '#') << add[i].orig();
             }
-            ost << "\n";
-            std::string ost_s = ost.str();
-            optr->write(ost_s.c_str(), ost_s.size());
-
-            auto af = getansw();
-            std::size_t lines = 0;
-            for(const auto &a: af) {
-                if(!lines) lines = a.size();
-                if(lines != a.size())
-                    throw std::runtime_error("gff result error (different size in columns)");
-            }
-            for(std::size_t l = 0; l < lines; ++l) {
-                ost = std::ostringstream();
+            out << '\n';
+            for(const auto &item: gff.get_by(type_s, attr_v)) {
                 for(std::size_t i = 0; i < add.size(); ++i) {
-                    if(i) ost << "\t";
-                    ost << af[i][l];
+                    if(i) out << '\t';
+                    add_columns[i](out, *item, nullptr);
+                }
+                out << '\n';
+                if(out.size() >= out_writer_t::block_size) {
+                    owriter.write(out.view());
+                    out.clear();
                 }
-                ost << "\n";
-                ost_s = ost.str();
-                optr->write(ost_s.c_str(), ost_s.size());
             }
+            owriter.write(out.view());
         }
     }
     catch(const std::exception &e) {
-        std::cerr << "[" << inopts.program_name() << " ERROR] " << e.what() << "\n";
+        anno_ok = false;
+        anno_err.what = e.what();
+    }
+    if(anno_ok && bgzf_ifile && !bgzf_ifile->error().empty()) { // broken bgzip input ends the stream
+        anno_ok = false;
+        anno_err.what = bgzf_ifile->error();
+    }
+    if(anno_ok && region_ifile && !region_ifile->error().empty()) {
+        anno_ok = false;
+        anno_err.what = region_ifile->error();
+    }
+    owriter.close();
+    if(!anno_ok) {
+        std::cerr << "[" << inopts.program_name() << " ERROR] " << anno_err.what << "\n";
         std::cerr << "columns: seqid=" << (seqid+1) << " pos=" << (pos+1) << " endpos=" << (endpos+1) << "\n";
-        std::cerr << "last value: seqid=" << (seqid_s ? *seqid_s : "null") << " pos=" << (pos_ui) << " endpos=" << (endpos_ui) << "\n";
-        std::cerr << "last line: '" << inln << "'" << std::endl;
+        std::cerr << "last value: seqid=" << (anno_err.query.valid ? anno_err.query.seqid : "null") << " pos=" << (anno_err.query.pos) << " endpos=" << (anno_err.query.endpos) << "\n";
+        std::cerr << "last line: '" << anno_err.line << "'" << std::endl;
+        return 1;
     }
 
     return 0;
@@ -0,0 +1,124 @@
+#include "outbuffer.h"
+#include "bgzf.h"
+#include <cerrno>
+#include <charconv>
+#include <fcntl.h>
+#include <unistd.h>
+
+out_buffer_t &out_buffer_t::append_uint(uint64_t val)
+{
+    char buf[24];
+    auto r = std::to_chars(buf, buf + sizeof(buf), val);
+    _data.append(buf, r.ptr - buf);
+    return *this;
+}
+
+out_buffer_t &out_buffer_t::append_int(int64_t val)
+{
+    char buf[24];
+    auto r = std::to_chars(buf, buf + sizeof(buf), val);
+    _data.append(buf, r.ptr - buf);
+    return *this;
+}
+
+out_buffer_t &out_buffer_t::append_fixed(double val, int precision)
+{
+    char buf[512]; // fixed notation of DBL_MAX is 309 digits
+    auto r = std::to_chars(buf, buf + sizeof(buf), val, std::chars_format::fixed, precision);
+    if(r.ec == std::errc())
+        _data.append(buf, r.ptr - buf);
+    else
+        _data.append(std::to_string(val));
+    return *this;
+}
+
+out_writer_t::~out_writer_t()
+{
+    close();
+}
+
+bool out_writer_t::open(const std::string &path, bool compress, int threads)
+{
+    if(path == "-") {
+        _fd = STDOUT_FILENO;
+        _own = false;
+    }
+    else {
+        _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        _own = _fd >= 0;
+    }
+    _buf.reserve(block_size);
+    if(compress && is_open())
+        _bgzf.reset(new bgzf_writer_t([this](std::string_view data) { return write_fd(data); }, threads));
+    return is_open();
+}
+
+bool out_writer_t::is_open() const
+{
+    return _fd >= 0;
+}
+
+void out_writer_t::write(std::string_view data)
+{
+    _buf.append(data.data(), data.size());
+    if(_buf.size() >= block_size)
+        send(false);
+}
+
+bool out_writer_t::flush()
+{
+    return send(true);
+}
+
+bool out_writer_t::close()
+{
+    if(_fd < 0) return false;
+    flush();
+    if(_bgzf) {
+        if(!_bgzf->finish()) _error = true;
+        _bgzf.reset();
+    }
+    if(_own)
+        ::close(_fd);
+    _fd = -1;
+    return !_error;
+}
+
+// all - everything buffered, otherwise only full BGZF blocks go to the compressor
+bool out_writer_t::send(bool all)
+{
+    if(_fd < 0 || _error) return false;
+    if(_bgzf) {
+        auto size = _buf.size();
+        if(!all) size -= size % bgzf_writer_t::block_text_size;
+        if(size) {
+            _bgzf->write(_buf.substr(0, size));
+            _buf.erase(0, size);
+        }
+        if(!_bgzf->good()) _error = true;
+        return !_error;
+    }
+    if(!write_fd(_buf)) _error = true;
+    _buf.clear();
+    return !_error;
+}
+
+// called by the compressor workers too (one at a time)
+bool out_writer_t::write_fd(std::string_view data)
+{
+    std::size_t done = 0;
+    while(done < data.size()) {
+        auto r = ::write(_fd, data.data() + done, data.size() - done);
+        if(r < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        done += static_cast<std::size_t>(r);
+    }
+    return true;
+}
+
+bool out_writer_t::good() const
+{
+    return !_error;
+}
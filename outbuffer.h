@@ -0,0 +1,68 @@
+#ifndef OUTBUFFER_H
+#define OUTBUFFER_H
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+class bgzf_writer_t;
+
+/**
+ * @brief The out_buffer_t class
+ * growable output buffer with fast integer/decimal formatting
+ * (reused between lines, no locale, no stream state)
+ */
+class out_buffer_t
+{
+    std::string _data;
+public:
+    out_buffer_t& operator<<(std::string_view str) {
+        _data.append(str.data(), str.size());
+        return *this;
+    }
+    out_buffer_t& operator<<(char c) {
+        _data.push_back(c);
+        return *this;
+    }
+    out_buffer_t& append_uint(uint64_t val);
+    out_buffer_t& append_int(int64_t val);
+    /**
+     * @brief append_fixed same as std::to_string(double) for precision 6 ("%f")
+     */
+    out_buffer_t& append_fixed(double val, int precision = 6);
+    std::string_view view() const { return _data; }
+    std::size_t size() const { return _data.size(); }
+    bool empty() const { return _data.empty(); }
+    void resize(std::size_t size) { _data.resize(size); }
+    void clear() { _data.clear(); }
+};
+
+/**
+ * @brief The out_writer_t class
+ * output file (or stdout for '-'), data is collected and written by write(2) in large blocks
+ * (compress - BGZF blocks deflated by 'threads' workers)
+ */
+class out_writer_t
+{
+    int _fd = -1;
+    bool _own = false;
+    bool _error = false;
+    std::string _buf;
+    std::unique_ptr<bgzf_writer_t> _bgzf;
+    bool send(bool all);
+    bool write_fd(std::string_view data);
+public:
+    static constexpr std::size_t block_size = 1 << 20;
+    out_writer_t() = default;
+    out_writer_t(const out_writer_t&) = delete;
+    out_writer_t& operator=(const out_writer_t&) = delete;
+    ~out_writer_t();
+    bool open(const std::string &path, bool compress = false, int threads = 0);
+    bool is_open() const;
+    void write(std::string_view data);
+    bool flush();
+    bool close(); // flush, end of BGZF file block, close
+    bool good() const;
+};
+
+#endif // OUTBUFFER_H
@@ -0,0 +1,27 @@
+#include "projcache.h"
+#include <limits>
+
+bool projection_cache_t::build(const std::vector<gffparser::gff_data_t> &data, std::size_t columns, const render_t &render)
+{
+    _base = nullptr;
+    _records = 0;
+    _columns = columns;
+    _text.clear();
+    _offsets.clear();
+    _offsets.reserve(data.size() * columns + 1);
+    _offsets.push_back(0);
+    for(const auto &d: data) {
+        for(std::size_t col = 0; col < columns; ++col) {
+            render(_text, d, col);
+            if(_text.size() > std::numeric_limits<uint32_t>::max()) {
+                _text.clear();
+                _offsets.clear();
+                return false;
+            }
+            _offsets.push_back(static_cast<uint32_t>(_text.size()));
+        }
+    }
+    _base = data.data();
+    _records = data.size();
+    return true;
+}
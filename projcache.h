@@ -0,0 +1,43 @@
+#ifndef PROJCACHE_H
+#define PROJCACHE_H
+#include "outbuffer.h"
+#include <cstdint>
+#include <functional>
+#include <gffparser.h>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief The projection_cache_t class
+ * pre-rendered output fragments ('-add' values) of the loaded gff records in one text:
+ * column col of record id is text[offsets[id * columns + col], offsets[id * columns + col + 1])
+ */
+class projection_cache_t
+{
+    const gffparser::gff_data_t *_base = nullptr;
+    std::size_t _records = 0;
+    std::size_t _columns = 0;
+    std::vector<uint32_t> _offsets;
+    out_buffer_t _text;
+public:
+    // appends the value of column col of a record
+    typedef std::function<void(out_buffer_t&, const gffparser::gff_data_t&, std::size_t col)> render_t;
+    /**
+     * @brief build renders every column of every record once
+     * @return false if the text doesn't fit 32-bit offsets (the cache stays empty)
+     */
+    bool build(const std::vector<gffparser::gff_data_t> &data, std::size_t columns, const render_t &render);
+    // fragment of a cached record, false for other records (lazily loaded seqids)
+    bool find(const gffparser::gff_data_t *d, std::size_t col, std::string_view &val) const {
+        // d may point into another array: compared as addresses, no pointer arithmetic outside data
+        auto addr = reinterpret_cast<std::uintptr_t>(d), base = reinterpret_cast<std::uintptr_t>(_base);
+        if(!_records || addr < base || addr - base >= _records * sizeof(*d)) return false;
+        auto id = (addr - base) / sizeof(*d);
+        id = id * _columns + col;
+        val = _text.view().substr(_offsets[id], _offsets[id + 1] - _offsets[id]);
+        return true;
+    }
+    bool empty() const { return _records == 0; }
+};
+
+#endif // PROJCACHE_H
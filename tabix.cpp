@@ -0,0 +1,401 @@
+#include "tabix.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+
+static bool parse_uint(std::string_view str, uint64_t &val)
+{
+    auto r = std::from_chars(str.data(), str.data() + str.size(), val);
+    return r.ec == std::errc() && r.ptr != str.data();
+}
+
+bool tabix_region_t::parse(const std::string &str, tabix_region_t &region)
+{
+    region = tabix_region_t();
+    region.seqid = str;
+    auto colon = str.rfind(':');
+    if(colon == std::string::npos)
+        return !str.empty();
+    std::string range;
+    for(auto c: str.substr(colon + 1))
+        if(c != ',') range.push_back(c);
+    auto dash = range.find('-');
+    uint64_t start = 0, end = 0;
+    if(!parse_uint(std::string_view(range).substr(0, dash), start))
+        return !str.empty(); // ':' is a part of the seqid name
+    if(start == 0) return false;
+    region.seqid = str.substr(0, colon);
+    region.beg = start - 1;
+    if(dash != std::string::npos && dash + 1 < range.size()) {
+        if(!parse_uint(std::string_view(range).substr(dash + 1), end) || end < start)
+            return false;
+        region.end = end;
+    }
+    return !region.seqid.empty();
+}
+
+/**
+ * little endian reader of the inflated index
+ */
+struct index_cursor_t {
+    const std::string &data;
+    std::size_t pos = 0;
+    bool ok = true;
+    template<typename T> T get() {
+        T v = 0;
+        if(pos + sizeof(T) > data.size()) {
+            ok = false;
+            return v;
+        }
+        for(std::size_t i = 0; i < sizeof(T); ++i)
+            v |= static_cast<T>(static_cast<unsigned char>(data[pos + i])) << (8 * i);
+        pos += sizeof(T);
+        return v;
+    }
+    int32_t get_i32() { return static_cast<int32_t>(get<uint32_t>()); }
+    bool has(std::size_t size) const { return ok && pos + size <= data.size(); }
+};
+
+bool tabix_index_t::load(const std::string &path)
+{
+    _tids.clear();
+    _refs.clear();
+    bgzf_reader_t reader(path);
+    if(!reader.is_open()) {
+        _error = "can't open '" + path + "'";
+        return false;
+    }
+    std::string data, block;
+    uint64_t coffset = 0;
+    while(reader.read_block(block, coffset))
+        data += block;
+    if(!reader.error().empty()) {
+        _error = reader.error();
+        return false;
+    }
+    index_cursor_t c{data};
+    auto bad_index = [&]() {
+        _error = "'" + path + "' is not a valid tabix/CSI index";
+        return false;
+    };
+    if(data.compare(0, 4, "TBI\1") == 0) {
+        _csi = false;
+        _min_shift = 14;
+        _depth = 5;
+        c.pos = 4;
+    }
+    else if(data.compare(0, 4, "CSI\1") == 0) {
+        _csi = true;
+        c.pos = 4;
+        _min_shift = c.get_i32();
+        _depth = c.get_i32();
+        auto l_aux = c.get_i32();
+        if(!c.ok || l_aux < 28 || _min_shift <= 0 || _depth <= 0 || _min_shift + _depth * 3 > 63)
+            return bad_index(); // CSI without the tabix configuration (bam index)
+    }
+    else return bad_index();
+
+    int32_t n_ref = 0;
+    if(!_csi) n_ref = c.get_i32();
+    _format = c.get_i32();
+    _col_seq = c.get_i32();
+    _col_beg = c.get_i32();
+    _col_end = c.get_i32();
+    _meta = static_cast<char>(c.get_i32());
+    _skip = c.get_i32();
+    auto l_nm = c.get_i32();
+    if(!c.ok || l_nm < 0 || !c.has(static_cast<std::size_t>(l_nm)) || _col_seq <= 0 || _col_beg <= 0)
+        return bad_index();
+    std::vector<std::string> names;
+    for(std::size_t p = c.pos, end = c.pos + l_nm; p < end; ) {
+        auto z = data.find('\0', p);
+        if(z == std::string::npos || z > end) z = end;
+        names.push_back(data.substr(p, z - p));
+        p = z + 1;
+    }
+    c.pos += l_nm;
+    if(_csi) n_ref = c.get_i32();
+    if(!c.ok || n_ref < 0 || static_cast<std::size_t>(n_ref) != names.size())
+        return bad_index();
+
+    const uint32_t pseudo_bin = ((1u << (3 * (_depth + 1))) - 1) / 7 + 1; // metadata, not chunks
+    _refs.resize(n_ref);
+    for(auto &ref: _refs) {
+        auto n_bin = c.get_i32();
+        for(int32_t b = 0; c.ok && b < n_bin; ++b) {
+            auto bin = c.get<uint32_t>();
+            uint64_t loffset = _csi ? c.get<uint64_t>() : 0;
+            auto n_chunk = c.get_i32();
+            if(!c.ok || n_chunk < 0 || !c.has(static_cast<std::size_t>(n_chunk) * 16))
+                return bad_index();
+            std::vector<chunk_t> chunks(n_chunk);
+            for(auto &ch: chunks) {
+                ch.beg = c.get<uint64_t>();
+                ch.end = c.get<uint64_t>();
+            }
+            if(bin == pseudo_bin) continue;
+            if(_csi) ref.loffsets[bin] = loffset;
+            ref.bins[bin] = std::move(chunks);
+        }
+        if(!_csi) {
+            auto n_intv = c.get_i32();
+            if(!c.ok || n_intv < 0 || !c.has(static_cast<std::size_t>(n_intv) * 8))
+                return bad_index();
+            ref.linear.resize(n_intv);
+            for(auto &o: ref.linear)
+                o = c.get<uint64_t>();
+        }
+        if(!c.ok) return bad_index();
+    }
+    for(std::size_t i = 0; i < names.size(); ++i)
+        _tids.emplace(names[i], i);
+    return true;
+}
+
+std::string tabix_index_t::find(const std::string &bgzpath)
+{
+    for(const char *ext: {".tbi", ".csi"}) {
+        std::error_code ec;
+        if(std::filesystem::exists(bgzpath + ext, ec))
+            return bgzpath + ext;
+    }
+    return "";
+}
+
+std::vector<tabix_index_t::chunk_t> tabix_index_t::chunks(const tabix_region_t &region) const
+{
+    std::vector<chunk_t> r;
+    auto tid = _tids.find(region.seqid);
+    if(tid == _tids.end()) return r;
+    const auto &ref = _refs[tid->second];
+    const uint64_t max_pos = 1ull << (_min_shift + _depth * 3);
+    uint64_t beg = std::min(region.beg, max_pos - 1);
+    uint64_t end = std::min(region.end, max_pos);
+    if(end <= beg) return r;
+
+    // chunks ending before the first record at beg can't overlap
+    uint64_t min_off = 0;
+    if(!_csi) {
+        if(!ref.linear.empty())
+            min_off = ref.linear[std::min<std::size_t>(beg >> _min_shift, ref.linear.size() - 1)];
+    }
+    else {
+        uint32_t bin = static_cast<uint32_t>(((1ull << (_depth * 3)) - 1) / 7 + (beg >> _min_shift));
+        for(;;) {
+            auto it = ref.loffsets.find(bin);
+            if(it != ref.loffsets.end()) {
+                min_off = it->second;
+                break;
+            }
+            if(!bin) break;
+            bin = (bin - 1) >> 3;
+        }
+    }
+    // bins overlapping [beg, end) on every level
+    --end;
+    uint64_t t = 0;
+    int s = _min_shift + _depth * 3;
+    for(int l = 0; l <= _depth; ++l) {
+        for(uint64_t b = t + (beg >> s), e = t + (end >> s); b <= e; ++b) {
+            auto it = ref.bins.find(static_cast<uint32_t>(b));
+            if(it == ref.bins.end()) continue;
+            for(const auto &ch: it->second)
+                if(ch.end > min_off) r.push_back(ch);
+        }
+        t += 1ull << (l * 3);
+        s -= 3;
+    }
+    std::sort(r.begin(), r.end(), [](const chunk_t &a, const chunk_t &b) { return a.beg < b.beg; });
+    std::size_t n = 0;
+    for(const auto &ch: r) {
+        if(n && ch.beg <= r[n-1].end)
+            r[n-1].end = std::max(r[n-1].end, ch.end);
+        else
+            r[n++] = ch;
+    }
+    r.resize(n);
+    return r;
+}
+
+bool tabix_index_t::record(std::string_view line, std::string_view &seqid, uint64_t &beg, uint64_t &end) const
+{
+    std::string_view fseq, fbeg, fend, fref, finfo;
+    int col = 1;
+    for(std::size_t start = 0; start <= line.size(); ++col) {
+        auto tab = std::min(line.find('\t', start), line.size());
+        auto f = line.substr(start, tab - start);
+        if(col == _col_seq) fseq = f;
+        if(col == _col_beg) fbeg = f;
+        if(col == _col_end) fend = f;
+        if(col == 4) fref = f;
+        if(col == 8) finfo = f;
+        start = tab + 1;
+    }
+    if(fseq.empty() || !parse_uint(fbeg, beg))
+        return false;
+    seqid = fseq;
+    if((_format & 0xffff) == format_vcf) {
+        if(beg) --beg;
+        end = beg + std::max<std::size_t>(fref.size(), 1);
+        // INFO END=<pos>
+        for(std::size_t p = 0; p < finfo.size(); ) {
+            auto sc = std::min(finfo.find(';', p), finfo.size());
+            auto item = finfo.substr(p, sc - p);
+            uint64_t e = 0;
+            if(item.size() > 4 && item.compare(0, 4, "END=") == 0 && parse_uint(item.substr(4), e))
+                end = e;
+            p = sc + 1;
+        }
+    }
+    else {
+        if(!(_format & format_ucsc) && beg) --beg;
+        if(_col_end <= 0 || !parse_uint(fend, end))
+            end = beg + 1;
+    }
+    if(end <= beg) end = beg + 1;
+    return true;
+}
+
+tabix_region_streambuf_t::tabix_region_streambuf_t(const std::string &bgzpath, const tabix_index_t &index,
+                                                   const std::vector<tabix_region_t> &regions)
+    : _reader(bgzpath), _index(index)
+{
+    // group by seqid (first appearance order), sort and merge overlapping regions
+    std::vector<std::string> order;
+    std::unordered_map<std::string, std::vector<tabix_region_t> > groups;
+    for(const auto &r: regions) {
+        auto &g = groups[r.seqid];
+        if(g.empty()) order.push_back(r.seqid);
+        g.push_back(r);
+    }
+    for(const auto &seqid: order) {
+        auto &g = groups[seqid];
+        std::sort(g.begin(), g.end(), [](const tabix_region_t &a, const tabix_region_t &b) { return a.beg < b.beg; });
+        for(const auto &r: g) {
+            if(!_regions.empty() && _regions.back().seqid == r.seqid && r.beg <= _regions.back().end)
+                _regions.back().end = std::max(_regions.back().end, r.end);
+            else
+                _regions.push_back(r);
+        }
+    }
+    if(!_reader.is_open()) return;
+    read_header();
+    if(!_cur.empty())
+        setg(&_cur[0], &_cur[0], &_cur[0] + _cur.size());
+}
+
+bool tabix_region_streambuf_t::seek(uint64_t voffset)
+{
+    _block.clear();
+    _block_pos = 0;
+    if(!_reader.seek(voffset >> 16)) {
+        _error = _reader.error();
+        return false;
+    }
+    if(!_reader.read_block(_block, _block_coffset)) {
+        _error = _reader.error();
+        return _error.empty();
+    }
+    _block_pos = std::min<std::size_t>(voffset & 0xffff, _block.size());
+    return true;
+}
+
+bool tabix_region_streambuf_t::next_line(std::string &line, uint64_t &voffset)
+{
+    line.clear();
+    bool started = false;
+    for(;;) {
+        if(_block_pos >= _block.size()) {
+            if(!_reader.read_block(_block, _block_coffset)) {
+                _block.clear();
+                _block_pos = 0;
+                _error = _reader.error();
+                return started && _error.empty(); // last line without '\n'
+            }
+            _block_pos = 0;
+            continue;
+        }
+        if(!started) {
+            voffset = (_block_coffset << 16) | _block_pos;
+            started = true;
+        }
+        auto nl = _block.find('\n', _block_pos);
+        if(nl == std::string::npos) {
+            line.append(_block, _block_pos, std::string::npos);
+            _block_pos = _block.size();
+            continue;
+        }
+        line.append(_block, _block_pos, nl - _block_pos);
+        _block_pos = nl + 1;
+        return true;
+    }
+}
+
+// meta and skipped lines at the beginning of the file
+void tabix_region_streambuf_t::read_header()
+{
+    if(!seek(0)) return;
+    uint64_t voffset = 0;
+    for(int n = 0; next_line(_line, voffset); ++n) {
+        if(n >= _index.skip() && !_index.is_meta(_line))
+            break;
+        _cur.append(_line).push_back('\n');
+    }
+}
+
+void tabix_region_streambuf_t::fill()
+{
+    while(_cur.size() < fill_size && _error.empty()) {
+        if(!_in_chunk) {
+            if(_next_chunk == _chunks.size()) {
+                if(_next_region == _regions.size()) break;
+                if(_next_region == 0 || _regions[_next_region].seqid != _region.seqid)
+                    _has_last = false;
+                _region = _regions[_next_region++];
+                _chunks = _index.chunks(_region);
+                _next_chunk = 0;
+                continue;
+            }
+            const auto &ch = _chunks[_next_chunk++];
+            if(!seek(ch.beg)) break;
+            _chunk_end = ch.end;
+            _in_chunk = true;
+        }
+        uint64_t voffset = 0;
+        if(!next_line(_line, voffset) || voffset >= _chunk_end) {
+            _in_chunk = false;
+            continue;
+        }
+        std::string_view seqid;
+        uint64_t beg = 0, end = 0;
+        if(!_index.record(_line, seqid, beg, end)) {
+            if(_index.is_meta(_line)) continue;
+            _error = "wrong record position in indexed file: '" + _line + "'";
+            break;
+        }
+        if(seqid != _region.seqid) continue;
+        if(beg >= _region.end) { // sorted: the rest of the region chunks are after it
+            _in_chunk = false;
+            _next_chunk = _chunks.size();
+            continue;
+        }
+        if(end > _region.beg && (!_has_last || voffset > _last)) {
+            _cur.append(_line).push_back('\n');
+            _last = voffset;
+            _has_last = true;
+        }
+    }
+}
+
+tabix_region_streambuf_t::int_type tabix_region_streambuf_t::underflow()
+{
+    if(gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+    _cur.clear();
+    fill();
+    if(_cur.empty())
+        return traits_type::eof();
+    setg(&_cur[0], &_cur[0], &_cur[0] + _cur.size());
+    return traits_type::to_int_type(*gptr());
+}
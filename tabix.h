@@ -0,0 +1,117 @@
+#ifndef TABIX_H
+#define TABIX_H
+#include "bgzf.h"
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * @brief The tabix_region_t struct
+ * query region, 0-based half-open [beg, end)
+ */
+struct tabix_region_t {
+    std::string seqid;
+    uint64_t beg = 0;
+    uint64_t end = std::numeric_limits<uint64_t>::max();
+    /**
+     * @brief parse 'chr', 'chr:start' or 'chr:start-end' (1-based, inclusive, ',' in numbers is allowed)
+     */
+    static bool parse(const std::string &str, tabix_region_t &region);
+};
+
+/**
+ * @brief The tabix_index_t class
+ * tabix (.tbi) or CSI (.csi) index of a bgzip compressed tab separated file:
+ * bins of virtual offset chunks (file offset of a block << 16 | offset in the inflated block)
+ */
+class tabix_index_t
+{
+public:
+    struct chunk_t {
+        uint64_t beg = 0; // virtual offsets
+        uint64_t end = 0;
+    };
+    bool load(const std::string &path);
+    /**
+     * @brief find index file of bgzpath ('<bgzpath>.tbi' or '<bgzpath>.csi'), empty if there is none
+     */
+    static std::string find(const std::string &bgzpath);
+    // chunks that may have records overlapping region, sorted and merged
+    std::vector<chunk_t> chunks(const tabix_region_t &region) const;
+    // record interval of a data line (0-based, half-open)
+    bool record(std::string_view line, std::string_view &seqid, uint64_t &beg, uint64_t &end) const;
+    bool is_meta(std::string_view line) const { return !line.empty() && line.front() == _meta; }
+    int skip() const { return _skip; }
+    const std::string& error() const { return _error; }
+private:
+    static constexpr int format_vcf = 2;
+    static constexpr int format_ucsc = 0x10000; // 0-based half-open coordinates (bed)
+    struct ref_t {
+        std::unordered_map<uint32_t, std::vector<chunk_t> > bins;
+        std::unordered_map<uint32_t, uint64_t> loffsets; // csi: min offset of the bin
+        std::vector<uint64_t> linear;                    // tbi: min offset of every 16KB window
+    };
+    bool _csi = false;
+    int _min_shift = 14;
+    int _depth = 5;
+    int _format = 0;
+    int _col_seq = 1;
+    int _col_beg = 4;
+    int _col_end = 5;
+    char _meta = '#';
+    int _skip = 0;
+    std::unordered_map<std::string, std::size_t> _tids;
+    std::vector<ref_t> _refs;
+    std::string _error;
+};
+
+/**
+ * @brief The tabix_region_streambuf_t class
+ * header lines of an indexed bgzip file and then the records overlapping the regions
+ * (regions of a seqid are sorted and merged, every record is read once)
+ */
+class tabix_region_streambuf_t : public std::streambuf
+{
+    static constexpr std::size_t fill_size = 1 << 20;
+    bgzf_reader_t _reader;
+    const tabix_index_t &_index;
+    std::vector<tabix_region_t> _regions;
+    std::size_t _next_region = 0;
+    tabix_region_t _region;
+    std::vector<tabix_index_t::chunk_t> _chunks;
+    std::size_t _next_chunk = 0;
+    uint64_t _chunk_end = 0;
+    bool _in_chunk = false;
+    bool _has_last = false;
+    uint64_t _last = 0;      // virtual offset of the last record passed (of the current seqid)
+    std::string _block;      // current inflated block
+    uint64_t _block_coffset = 0;
+    std::size_t _block_pos = 0;
+    std::string _line;
+    std::string _cur;        // current get area
+    std::string _error;
+    bool seek(uint64_t voffset);
+    bool next_line(std::string &line, uint64_t &voffset);
+    void read_header();
+    void fill();
+protected:
+    int_type underflow() override;
+public:
+    tabix_region_streambuf_t(const std::string &bgzpath, const tabix_index_t &index,
+                             const std::vector<tabix_region_t> &regions);
+    bool is_open() const { return _reader.is_open(); }
+    const std::string& error() const { return _error; }
+};
+
+class tabix_region_istream_t : public std::istream
+{
+    tabix_region_streambuf_t _buf;
+public:
+    tabix_region_istream_t(const std::string &bgzpath, const tabix_index_t &index,
+                           const std::vector<tabix_region_t> &regions)
+        : std::istream(nullptr), _buf(bgzpath, index, regions) { rdbuf(&_buf); }
+    bool is_open() const { return _buf.is_open(); }
+    const std::string& error() const { return _buf.error(); }
+};
+
+#endif // TABIX_H
@@ -0,0 +1,520 @@
+// checks of gff3anno: '.gzidx' round trip and '-region' queries on the bgzipped fixtures
+// of test/data ('regions.*.gz' and their .tbi/.csi indexes, '*.expected' - header and the records
+// overlapping the regions below, computed by brute force), gffparser position queries
+#include "gzindex.h"
+#include "tabix.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <gffparser.h>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+#include <utime.h>
+
+namespace fs = std::filesystem;
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+        ++failures; \
+    } \
+} while(0)
+
+static std::string read_file(const fs::path &path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+}
+
+static std::string read_stream(std::istream &is)
+{
+    std::ostringstream oss;
+    oss << is.rdbuf();
+    return oss.str();
+}
+
+// gff text with a header, several seqid blocks and a seqid repeated after another one
+static std::string make_gff(std::vector<std::pair<std::string, std::string> > &blocks)
+{
+    std::string text = "##gff-version 3\n#comment\n";
+    const char *seqids[] = {"chr1", "chr2", "chrM", "chr1"};
+    uint64_t pos = 1;
+    for(const char *seqid: seqids) {
+        std::string block;
+        for(int i = 0; i < 3000; ++i, pos += 97) {
+            block += std::string(seqid) + "\ttest\texon\t" + std::to_string(pos) + "\t" + std::to_string(pos + 500) +
+                     "\t.\t+\t.\tID=e" + std::to_string(pos) + ";gene_name=G" + std::to_string(pos % 1013) + "\n";
+        }
+        text += block;
+        blocks.push_back({seqid, block});
+    }
+    return text;
+}
+
+static bool write_gzip(const fs::path &path, const std::string &text)
+{
+    gzFile gz = gzopen(path.c_str(), "wb6");
+    if(!gz) return false;
+    bool ok = gzwrite(gz, text.data(), static_cast<unsigned>(text.size())) == static_cast<int>(text.size());
+    return gzclose(gz) == Z_OK && ok;
+}
+
+static std::string range_text(const std::string &path, const gz_index_t &index, uint64_t begin, uint64_t end)
+{
+    if(index.plain())
+        return read_file(path).substr(begin, end - begin);
+    gz_index_istream_t is(path, index, 2, begin, end);
+    return read_stream(is);
+}
+
+static bool same_ranges(const std::vector<gz_index_t::range_t> &a, const std::vector<gz_index_t::range_t> &b)
+{
+    return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const auto &x, const auto &y) {
+        return x.seqid == y.seqid && x.begin == y.begin && x.end == y.end && x.linenum == y.linenum;
+    });
+}
+
+static void check_gzindex(const fs::path &dir)
+{
+    std::vector<std::pair<std::string, std::string> > blocks;
+    auto text = make_gff(blocks);
+    auto plain = (dir / "a.gff3").string();
+    auto gz = (dir / "a.gff3.gz").string();
+    { std::ofstream(plain, std::ios::binary) << text; }
+    CHECK(write_gzip(gz, text));
+    for(const auto &path: {plain, gz}) {
+        gz_index_t index;
+        CHECK(index.build(path, 64 << 10));
+        CHECK(index.plain() == (path == plain));
+        CHECK(index.plain() || index.points().size() > 2);
+        CHECK(index.size() == text.size());
+        CHECK(index.header_end() == text.find("chr1"));
+        CHECK(index.seqids() == std::vector<std::string>({"chr1", "chr2", "chrM"}));
+        // the seqid blocks in file order
+        std::vector<std::string> got;
+        for(const auto &seqid: {"chr1", "chr2", "chrM"}) {
+            for(const auto &r: index.seqid_ranges(seqid))
+                got.push_back(range_text(path, index, r.begin, r.end));
+        }
+        // line numbers of the blocks: 2 header lines, 3000 lines per block
+        CHECK(index.seqid_ranges("chr1").size() == 2 && index.seqid_ranges("chr1")[0].linenum == 3 &&
+              index.seqid_ranges("chr1")[1].linenum == 9003 && index.seqid_ranges("chrM")[0].linenum == 6003);
+        CHECK(got.size() == blocks.size());
+        CHECK(got.size() == 4 && got[0] == blocks[0].second && got[1] == blocks[3].second &&
+              got[2] == blocks[1].second && got[3] == blocks[2].second);
+        if(!index.plain()) {
+            gz_index_istream_t is(path, index, 3);
+            CHECK(read_stream(is) == text);
+        }
+
+        auto idxpath = gz_index_t::default_path(path);
+        CHECK(index.save(idxpath));
+        gz_index_t loaded;
+        CHECK(loaded.load(idxpath, path));
+        CHECK(loaded.plain() == index.plain());
+        CHECK(loaded.size() == index.size());
+        CHECK(loaded.header_end() == index.header_end());
+        CHECK(loaded.points().size() == index.points().size());
+        for(std::size_t i = 0; i < loaded.points().size() && i < index.points().size(); ++i) {
+            const auto &a = loaded.points()[i];
+            const auto &b = index.points()[i];
+            CHECK(a.out == b.out && a.in == b.in && a.bits == b.bits && a.window == b.window);
+        }
+        CHECK(loaded.seqids() == index.seqids());
+        for(const auto &seqid: index.seqids())
+            CHECK(same_ranges(loaded.seqid_ranges(seqid), index.seqid_ranges(seqid)));
+        if(!loaded.plain()) {
+            auto r = loaded.seqid_ranges("chrM").front();
+            CHECK(range_text(path, loaded, r.begin, r.end) == blocks[2].second);
+        }
+        else { // the ranges met by a load give the same index
+            std::vector<gz_index_t::range_t> ranges;
+            for(const auto &seqid: {"chr1", "chr2", "chrM"}) {
+                for(auto &r: index.seqid_ranges(seqid))
+                    ranges.push_back(r);
+            }
+            std::sort(ranges.begin(), ranges.end(), [](const auto &a, const auto &b) { return a.begin < b.begin; });
+            gz_index_t assigned;
+            CHECK(assigned.assign_plain(path, std::move(ranges)));
+            CHECK(assigned.plain() && assigned.size() == index.size() && assigned.header_end() == index.header_end());
+            CHECK(assigned.seqids() == index.seqids());
+            for(const auto &seqid: index.seqids())
+                CHECK(same_ranges(assigned.seqid_ranges(seqid), index.seqid_ranges(seqid)));
+        }
+
+        // truncated index and index of another version of the file are rejected
+        auto saved = read_file(idxpath);
+        { std::ofstream(idxpath, std::ios::binary) << saved.substr(0, saved.size() - 1); }
+        CHECK(!gz_index_t().load(idxpath, path));
+        { std::ofstream(idxpath, std::ios::binary) << saved; }
+        CHECK(gz_index_t().load(idxpath, path));
+        struct utimbuf times = {1, 1};
+        CHECK(::utime(path.c_str(), &times) == 0);
+        CHECK(!gz_index_t().load(idxpath, path));
+    }
+    gz_index_t missing;
+    CHECK(!missing.build((dir / "missing.gz").string()));
+    CHECK(!missing.error().empty());
+}
+
+static void check_regions(const fs::path &data, const std::string &name)
+{
+    // the regions the expected files are made for
+    const char *regions_s[] = {"chr1:20000-90000", "chr1:5000-6000", "chr2", "chrX:100000-150000",
+                               "chrZ", "chr1:1000000-2000000"};
+    std::vector<tabix_region_t> regions;
+    for(const char *s: regions_s) {
+        tabix_region_t r;
+        CHECK(tabix_region_t::parse(s, r));
+        regions.push_back(r);
+    }
+    auto path = (data / (name + ".gz")).string();
+    auto idxpath = tabix_index_t::find(path);
+    CHECK(!idxpath.empty());
+    tabix_index_t index;
+    CHECK(index.load(idxpath));
+    tabix_region_istream_t is(path, index, regions);
+    CHECK(is.is_open());
+    auto got = read_stream(is);
+    CHECK(is.error().empty());
+    if(got != read_file(data / (name + ".expected"))) {
+        std::cerr << name << ": '-region' output differs from " << name << ".expected" << std::endl;
+        ++failures;
+    }
+}
+
+static void check_region_parse()
+{
+    tabix_region_t r;
+    CHECK(tabix_region_t::parse("chr1:1,000-2,000", r) && r.seqid == "chr1" && r.beg == 999 && r.end == 2000);
+    CHECK(tabix_region_t::parse("chr2:5", r) && r.seqid == "chr2" && r.beg == 4);
+    CHECK(tabix_region_t::parse("chrX", r) && r.seqid == "chrX" && r.beg == 0);
+    CHECK(tabix_region_t::parse("HLA:x", r) && r.seqid == "HLA:x"); // ':' of a seqid name
+    CHECK(!tabix_region_t::parse("chr1:0-5", r));
+    CHECK(!tabix_region_t::parse("chr1:10-5", r));
+}
+
+// checksum of the snapshot payload (as gffparser computes it), for the corrupted copies below
+static uint64_t snapshot_checksum(std::string_view data)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    std::size_t i = 0;
+    for(; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+        uint64_t w;
+        std::memcpy(&w, data.data() + i, sizeof(w));
+        h = (h ^ w) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    for(; i < data.size(); ++i)
+        h = (h ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ULL;
+    return h;
+}
+
+// snapshot round trip, damaged snapshots are rejected with an error
+static void check_snapshot(const fs::path &dir)
+{
+    const std::size_t n = 10;
+    gffparser::gff_parser_t gff;
+    gff << "##gff-version 3";
+    for(std::size_t i = 0; i < n; ++i) {
+        gff << "chr1\tt\texon\t" + std::to_string(100 * i + 1) + "\t" + std::to_string(100 * i + 150 + (i % 3) * 400) +
+               "\t0.5\t-\t0\tID=e" + std::to_string(i) + ";rank=" + std::to_string(i) + ";w=1.25;name=N" + std::to_string(i % 4);
+    }
+    auto path = (dir / "a.gffsnap").string();
+    gff.save_snapshot(path);
+    CHECK(!gff.has_error());
+    CHECK(gffparser::gff_parser_t::is_snapshot(path));
+
+    gffparser::gff_parser_t loaded;
+    loaded.load_snapshot(path);
+    CHECK(!loaded.has_error());
+    CHECK(loaded.size() == gff.size());
+    bool same = loaded.size() == gff.size();
+    for(std::size_t i = 0; same && i < gff.size(); ++i)
+        same = loaded.data()[i].str() == gff.data()[i].str() && loaded.data()[i].linenum == gff.data()[i].linenum;
+    CHECK(same);
+    std::vector<gffparser::gff_data_t*> a, b;
+    for(uint64_t pos = 0; pos < 100 * n + 1000; pos += 37) {
+        gff.overlap("chr1", pos, pos + 50, gffparser::gff_filter_t(), a);
+        loaded.overlap("chr1", pos, pos + 50, gffparser::gff_filter_t(), b);
+        bool eq = a.size() == b.size();
+        for(std::size_t i = 0; eq && i < a.size(); ++i)
+            eq = a[i] - gff.data().data() == b[i] - loaded.data().data();
+        if(!eq) {
+            CHECK(eq);
+            break;
+        }
+    }
+    CHECK(loaded.get_by_type("exon").size() == n);
+    CHECK(loaded.get_by_attr({gffparser::gff_attribute_t("name", "N1")}).size() == 3);
+
+    auto saved = read_file(path);
+    auto rejected = [&](const std::string &text, bool onlystrval = false) {
+        { std::ofstream(path, std::ios::binary | std::ios::trunc) << text; }
+        gffparser::gff_parser_t g(0, onlystrval);
+        g.load_snapshot(path);
+        return g.has_error() && !g.error().empty();
+    };
+    CHECK(!rejected(saved));
+    CHECK(rejected(saved.substr(0, saved.size() - 1)));   // truncated
+    auto flipped = saved;
+    flipped[flipped.size() / 2] ^= 0x10;
+    CHECK(rejected(flipped));                             // checksum mismatch
+    CHECK(rejected(saved, true));                         // typed values, string only load
+    // stored tree level of the only seqid: the last field before the source and type groups
+    // (one group each: count, name, id count, n ids), rejected even with a valid checksum
+    const std::size_t header_size = 48, checksum_at = 24;
+    auto level_at = saved.size() - 2 * (4 + 4 + 8 + 4 * n) - 4;
+    int32_t level = 0;
+    std::memcpy(&level, &saved[level_at], sizeof(level));
+    CHECK(level == 3); // floor(log2(10))
+    auto bad_level = saved;
+    level = 5;
+    std::memcpy(&bad_level[level_at], &level, sizeof(level));
+    auto sum = snapshot_checksum(std::string_view(bad_level).substr(header_size));
+    std::memcpy(&bad_level[checksum_at], &sum, sizeof(sum));
+    CHECK(rejected(bad_level));
+    level = 3; // the same bytes with the right level load
+    std::memcpy(&bad_level[level_at], &level, sizeof(level));
+    sum = snapshot_checksum(std::string_view(bad_level).substr(header_size));
+    std::memcpy(&bad_level[checksum_at], &sum, sizeof(sum));
+    CHECK(!rejected(bad_level));
+}
+
+// '-where' pushed into the load keeps the records a full load and the query filter select
+static void check_where(const fs::path &dir)
+{
+    using gffparser::gff_attribute_t;
+    std::string text = "##gff-version 3\n";
+    const char *types[] = {"gene", "exon", "CDS"};
+    for(int i = 0; i < 5000; ++i) {
+        text += std::string(i % 2 ? "chr1" : "chr2") + "\tt\t" + types[i % 3] + "\t" + std::to_string(i + 1) + "\t" +
+                std::to_string(i + 100) + "\t.\t+\t.\tID=r" + std::to_string(i);
+        if(i % 5) text += ";gene_name=G" + std::to_string(i % 50);
+        text += ";rank=" + std::to_string(i % 9) + ";w=" + (i % 4 ? "1.5" : "1.50");
+        if(i % 7 == 0) text += ";tag=a;tag=b"; // repeated name, the last value is stored
+        else if(i % 7 == 1) text += ";tag=a";
+        text += "\n";
+    }
+    auto path = (dir / "where.gff3").string();
+    { std::ofstream(path, std::ios::binary) << text; }
+
+    struct where_t {
+        std::string type;
+        std::vector<gff_attribute_t> attr;
+    };
+    std::vector<where_t> wheres = {
+        {"exon", {}},
+        {"", {gff_attribute_t("gene_name", "G1").add_value("G7")}},
+        {"CDS", {gff_attribute_t("gene_name", "G2"), gff_attribute_t("tag", "a")}},
+        {"", {gff_attribute_t("tag", "b")}},
+        {"", {gff_attribute_t("tag", "a")}},
+        {"gene", {gff_attribute_t("rank", int64_t(3)).add_value(int64_t(6))}},
+        {"", {gff_attribute_t("rank", "5")}},
+        {"", {gff_attribute_t("w", 1.5)}},
+        {"", {gff_attribute_t("w", "1.50")}},
+        {"mRNA", {}},
+        {"", {gff_attribute_t("gene_name", "none")}},
+    };
+    auto records = [](const std::vector<const gffparser::gff_data_t*> &items) {
+        std::vector<std::string> r;
+        for(const auto *d: items)
+            r.push_back(std::to_string(d->linenum) + ":" + d->str());
+        return r;
+    };
+    for(bool onlystrval: {false, true}) {
+        for(int threads: {0, 2}) {
+            gffparser::gff_parser_t full(threads, onlystrval);
+            full.load_file(path);
+            full.flush();
+            CHECK(!full.has_error() && full.size() == 5000);
+            std::size_t bad = 0, selected = 0;
+            for(const auto &w: wheres) {
+                gffparser::gff_filter_t filter(w.type, w.attr);
+                std::vector<const gffparser::gff_data_t*> expected, got;
+                for(const auto &d: full.data()) {
+                    if(filter.match(d)) expected.push_back(&d);
+                }
+                gffparser::gff_parser_t pushed(threads, onlystrval);
+                pushed.set_load_filter(w.type, "", w.attr);
+                pushed.load_file(path);
+                pushed.flush();
+                if(pushed.has_error()) ++bad;
+                for(const auto &d: pushed.data())
+                    got.push_back(&d);
+                if(records(got) != records(expected)) ++bad;
+                selected += expected.size();
+            }
+            CHECK(bad == 0);
+            CHECK(selected > 0);
+        }
+    }
+}
+
+// SIMD delimiter scans give the scalar offsets on lengths around the 16/32 byte blocks
+// (an unsupported kernel falls back to the best available one)
+static void check_find_delims()
+{
+    using gffparser::utils::delims_impl_t;
+    std::mt19937 rnd(5);
+    const char alphabet[] = "ab\t;=\"\n\x80\xff";
+    std::size_t bad = 0;
+    for(std::size_t len: {0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100}) {
+        for(int k = 0; k < 50; ++k) {
+            std::string line;
+            for(std::size_t i = 0; i < len; ++i)
+                line += alphabet[rnd() % (sizeof(alphabet) - 1)];
+            if(len && k == 0) line.front() = line.back() = '\t'; // delimiters on the edges
+            for(std::string_view delims: {"\t", "\t\"", ";=", "\t;=\""}) {
+                std::vector<uint32_t> expected, got;
+                for(std::size_t i = 0; i < line.size(); ++i) {
+                    if(delims.find(line[i]) != std::string_view::npos)
+                        expected.push_back(static_cast<uint32_t>(i));
+                }
+                for(auto impl: {delims_impl_t::scalar, delims_impl_t::sse2, delims_impl_t::avx2, delims_impl_t::best}) {
+                    got.assign(3, 7); // offsets are replaced, not appended
+                    gffparser::utils::find_delims(line, delims, got, impl);
+                    if(got != expected) ++bad;
+                }
+            }
+        }
+    }
+    CHECK(bad == 0);
+}
+
+// records overlapping [start, end] by a scan of all records, file order
+static std::vector<const gffparser::gff_data_t*> scan_overlap(const gffparser::gff_parser_t &gff, const std::string &seqid,
+                                                              uint64_t start, uint64_t end)
+{
+    std::vector<const gffparser::gff_data_t*> r;
+    for(const auto &d: gff.data()) {
+        if(d.position.seqid.str() == seqid && d.position.start <= end && d.position.end >= start)
+            r.push_back(&d);
+    }
+    return r;
+}
+
+static bool same_records(const std::vector<gffparser::gff_data_t*> &a, const std::vector<const gffparser::gff_data_t*> &b)
+{
+    return std::equal(a.begin(), a.end(), b.begin(), b.end());
+}
+
+// interval index, sweep and batch queries against the scan: one base features, equal starts,
+// nested features, queries on the feature bounds and outside all features
+static void check_overlap()
+{
+    std::mt19937 rnd(17);
+    gffparser::gff_parser_t gff;
+    gff << "##gff-version 3";
+    const char *seqids[] = {"chr1", "chr2"};
+    std::vector<uint64_t> bounds;
+    for(int i = 0; i < 3000; ++i) {
+        uint64_t start = 1 + rnd() % 20000;
+        uint64_t len = i % 5 == 0 ? 0 : (i % 7 == 0 ? rnd() % 5000 : rnd() % 300);
+        if(i % 11 == 0) start = 100; // equal starts
+        gff << std::string(seqids[i % 2]) + "	t	exon	" + std::to_string(start) + "	" + std::to_string(start + len) +
+               "	.	+	.	ID=e" + std::to_string(i);
+        bounds.push_back(start);
+        bounds.push_back(start + len);
+    }
+    gff.flush();
+    CHECK(gff.size() == 3000);
+    struct query_t {
+        std::string seqid;
+        uint64_t start, end;
+    };
+    std::vector<query_t> queries;
+    for(std::size_t i = 0; i < 2000; ++i) {
+        auto b = bounds[rnd() % bounds.size()];
+        switch(i % 4) {
+        case 0: queries.push_back({seqids[i % 2], b, b}); break;            // one position on a bound
+        case 1: queries.push_back({seqids[i % 2], b + 1, b + 1}); break;    // next to a bound
+        case 2: queries.push_back({seqids[i % 2], b, b + rnd() % 1000}); break;
+        default: queries.push_back({seqids[i % 2], b > 500 ? b - 500 : 0, b}); break;
+        }
+    }
+    queries.push_back({"chr1", 0, 0});
+    queries.push_back({"chr1", 30000, 40000}); // after all features
+    queries.push_back({"chr1", 0, 100000});    // every feature
+    queries.push_back({"chr1", 10, 5});        // start > end
+    queries.push_back({"chrZ", 1, 100000});    // unknown seqid
+
+    std::vector<gffparser::gff_data_t*> got;
+    std::size_t bad = 0;
+    for(const auto &q: queries) {
+        auto expected = q.start <= q.end ? scan_overlap(gff, q.seqid, q.start, q.end)
+                                         : std::vector<const gffparser::gff_data_t*>();
+        gff.overlap(q.seqid, q.start, q.end, gffparser::gff_filter_t(), got);
+        if(!same_records(got, expected)) ++bad;
+        std::size_t n = 0;
+        gff.for_each_overlap(q.seqid, q.start, q.end, gffparser::gff_filter_t(), [&](gffparser::gff_data_t&) { ++n; });
+        if(n != expected.size()) ++bad;
+    }
+    CHECK(bad == 0);
+
+    // a sweep answers sorted and unsorted queries as overlap()
+    auto sorted = queries;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const query_t &a, const query_t &b) {
+        return a.seqid != b.seqid ? a.seqid < b.seqid : a.start < b.start;
+    });
+    for(const auto *list: {&sorted, &queries}) {
+        gffparser::gff_sweep_t sweep(gff);
+        bad = 0;
+        for(const auto &q: *list) {
+            auto expected = q.start <= q.end ? scan_overlap(gff, q.seqid, q.start, q.end)
+                                             : std::vector<const gffparser::gff_data_t*>();
+            sweep.overlap(q.seqid, q.start, q.end, gffparser::gff_filter_t(), got);
+            std::sort(got.begin(), got.end());
+            if(!same_records(got, expected)) ++bad;
+        }
+        CHECK(bad == 0);
+    }
+
+    std::vector<gffparser::gff_query_t> batch;
+    for(const auto &q: queries)
+        batch.push_back({q.seqid, q.start, q.end});
+    std::vector<std::size_t> seen(batch.size(), 0);
+    bad = 0;
+    gff.get_by_batch(batch, gffparser::gff_filter_t(), [&](std::size_t i, const std::vector<gffparser::gff_data_t*> &found) {
+        ++seen[i];
+        auto sorted_found = found;
+        std::sort(sorted_found.begin(), sorted_found.end());
+        const auto &q = queries[i];
+        auto expected = q.start <= q.end ? scan_overlap(gff, q.seqid, q.start, q.end)
+                                         : std::vector<const gffparser::gff_data_t*>();
+        if(!same_records(sorted_found, expected)) ++bad;
+    });
+    CHECK(bad == 0);
+    CHECK(std::all_of(seen.begin(), seen.end(), [](std::size_t n) { return n == 1; }));
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2) {
+        std::cerr << "USAGE: program path/to/test/data" << std::endl;
+        return 1;
+    }
+    fs::path data(argv[1]);
+    auto dir = fs::temp_directory_path() / ("gff3anno_test." + std::to_string(::getpid()));
+    fs::create_directories(dir);
+    check_gzindex(dir);
+    check_snapshot(dir);
+    check_where(dir);
+    fs::remove_all(dir);
+    check_region_parse();
+    check_regions(data, "regions.bed");
+    check_regions(data, "regions.vcf");
+    check_overlap();
+    check_find_delims();
+    if(failures) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}